@@ -0,0 +1,110 @@
+#pragma once
+
+#include "../../net/net.h"
+#include "../../olc/olcPixelGameEngine.h"
+
+namespace BreakOut
+{
+    // Stages of a paddle command, from its bytes being decoded to the frame showing it.
+    // All timestamps are net::protocol::timestampNow() nanoseconds.
+    enum class LatencyStage
+    {
+        Link,    // sent by the robot -> received, its clock mapped onto ours (framed clients with a heartbeat)
+        Queue,   // received -> consumed by the session tick
+        Render,  // consumed -> frame drawn and its texture uploaded
+        Present, // uploaded -> DisplayFrame returned
+        Total,   // received -> DisplayFrame returned
+    };
+
+    class LatencyStats
+    {
+    public:
+        net::latency_histogram &Stage(LatencyStage stage) { return stages[size_t(stage)]; }
+
+        void Reset()
+        {
+            for (auto &stage : stages)
+                stage.reset();
+        }
+
+        void Dump(std::ostream &os)
+        {
+            static const char *names[] = {"link", "queue", "render", "present", "total"};
+            net::printHistogramHeader(os, "LATENCY");
+            for (size_t i = 0; i < stageCount; ++i)
+                net::printHistogram(os, "LATENCY", names[i], stages[i]);
+        }
+
+    private:
+        static constexpr size_t stageCount = 5;
+        net::latency_histogram stages[stageCount];
+    };
+
+    // Metrics of the game loops, exported along with the transport's (see net::metrics_registry).
+    struct GameMetrics
+    {
+        net::metric_histogram &frameTime;
+        net::metric_gauge &fps;
+        net::metric_histogram &workerTick;
+        net::metric_counter &commandsConsumed;
+        net::metric_counter &commandsOverwritten;
+
+        static GameMetrics &Get()
+        {
+            static GameMetrics metrics(net::metrics_registry::global());
+            return metrics;
+        }
+
+    private:
+        explicit GameMetrics(net::metrics_registry &registry)
+            : frameTime(registry.histogram("game_frame_seconds", "Time between two frames of the engine loop.")),
+              fps(registry.gauge("game_fps", "Frames per second of the engine loop, over the last second.")),
+              workerTick(registry.histogram("game_worker_tick_seconds", "Time a worker takes to step all of its sessions once.")),
+              commandsConsumed(registry.counter("game_commands_consumed_total", "Commands used by a session tick.")),
+              commandsOverwritten(registry.counter("game_commands_overwritten_total", "Commands replaced by a newer one before any tick used them."))
+        {
+        }
+    };
+
+    // Engine extension timing the frames that show a new command of the windowed
+    // session; the game tells it which command a frame consumed.
+    class LatencyProbe : public olc::PGEX
+    {
+    public:
+        LatencyProbe(LatencyStats &latencyStats) : olc::PGEX(true), stats(latencyStats)
+        {
+        }
+
+        // engine thread, during OnUserUpdate
+        void FrameConsumed(uint64_t received, uint64_t consumed)
+        {
+            pending = true;
+            receivedAt = received;
+            consumedAt = consumed;
+        }
+
+    protected:
+        void OnBeforeDisplayFrame() override
+        {
+            if (!pending)
+                return;
+            uploadedAt = net::protocol::timestampNow();
+            stats.Stage(LatencyStage::Render).record(uploadedAt - consumedAt);
+        }
+
+        void OnAfterDisplayFrame() override
+        {
+            if (!pending)
+                return;
+            const uint64_t displayedAt = net::protocol::timestampNow();
+            stats.Stage(LatencyStage::Present).record(displayedAt - uploadedAt);
+            stats.Stage(LatencyStage::Total).record(displayedAt - receivedAt);
+            pending = false;
+        }
+
+    private:
+        LatencyStats &stats;
+        bool pending = false;
+        uint64_t receivedAt = 0, consumedAt = 0, uploadedAt = 0;
+    };
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "../../olc/olcPixelGameEngine.h"
+#include "Server.h"
+
+namespace BreakOut
+{
+    // Single thread mode: the engine loop polls the server right before each
+    // OnUserUpdate, so a command is read, dispatched and consumed by the frame
+    // on the engine thread, with no hand-off to the asio or server threads.
+    class Reactor : public olc::PGEX
+    {
+    public:
+        Reactor(Server *polledServer) : olc::PGEX(true), server(polledServer)
+        {
+        }
+
+    protected:
+        void OnBeforeUserUpdate(float &elapsedTime) override
+        {
+            server->poll();
+        }
+
+    private:
+        Server *server;
+    };
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include "Session.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace BreakOut
+{
+    enum class RecordKind : uint16_t
+    {
+        SessionOpen = 1,   // value: seed of the session's world
+        SessionClose = 2,  // value: unused
+        Command = 3,       // value: the message_t bits
+        Control = 4,       // value: ControlCode in the low 32 bits, its argument in the high ones
+        SessionDetach = 5, // value: unused; the link failed, the session waits frozen for its client
+        SessionResume = 6, // session: the new connection id, value: the id the session had so far
+    };
+
+    // One event of the log, in host byte order.
+    struct RecordEntry
+    {
+        uint64_t time = 0;    // net::protocol::timestampNow() when received
+        uint32_t session = 0; // connection id
+        RecordKind kind = RecordKind::Command;
+        uint16_t reserved = 0;
+        uint64_t value = 0;
+    };
+
+    // Start of a log file; the entries follow it. count is updated as entries
+    // are written, so a log cut short by a crash is still readable up to there.
+    struct RecordHeader
+    {
+        char magic[8] = {'B', 'O', 'R', 'E', 'C', 'L', 'O', 'G'};
+        uint32_t version = 1;
+        uint32_t entrySize = sizeof(RecordEntry);
+        int32_t width = 0;
+        int32_t height = 0;
+        float tickRate = 0;
+        uint32_t reserved = 0;
+        uint64_t startTime = 0; // net::protocol::timestampNow() when recording started
+        int64_t wallClock = 0;  // unix time (s) when recording started
+        uint64_t count = 0;     // entries written so far
+        uint64_t reserved2 = 0;
+    };
+
+    // A file mapped in memory, which grows by remapping. One thread only.
+    class MappedFile
+    {
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile &) = delete;
+        ~MappedFile() { Close(size); }
+
+        // creates (or empties) the file with size bytes, zero filled
+        bool Open(const std::string &path, size_t initialSize)
+        {
+#if defined(_WIN32)
+            file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+                return false;
+#else
+            file = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (file < 0)
+                return false;
+#endif
+            return Map(initialSize);
+        }
+
+        bool Resize(size_t newSize)
+        {
+            Unmap();
+            return Map(newSize);
+        }
+
+        // unmaps and cuts the file down to finalSize bytes
+        void Close(size_t finalSize)
+        {
+            Unmap();
+#if defined(_WIN32)
+            if (file == INVALID_HANDLE_VALUE)
+                return;
+            LARGE_INTEGER end;
+            end.QuadPart = LONGLONG(finalSize);
+            if (SetFilePointerEx(file, end, nullptr, FILE_BEGIN))
+                SetEndOfFile(file);
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+#else
+            if (file < 0)
+                return;
+            if (ftruncate(file, off_t(finalSize)) != 0)
+                std::cerr << "[RECORDER] Cannot trim the log: " << std::strerror(errno) << "\n";
+            ::close(file);
+            file = -1;
+#endif
+        }
+
+        uint8_t *Data() { return data; }
+        size_t Size() const { return size; }
+
+    private:
+#if defined(_WIN32)
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#else
+        int file = -1;
+#endif
+        uint8_t *data = nullptr;
+        size_t size = 0;
+
+        bool Map(size_t newSize)
+        {
+#if defined(_WIN32)
+            // the mapping extends the file
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, DWORD(uint64_t(newSize) >> 32), DWORD(newSize), nullptr);
+            if (!mapping)
+                return false;
+            data = static_cast<uint8_t *>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, newSize));
+#else
+            if (ftruncate(file, off_t(newSize)) != 0)
+                return false;
+            void *mapped = mmap(nullptr, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+            data = mapped == MAP_FAILED ? nullptr : static_cast<uint8_t *>(mapped);
+#endif
+            size = data ? newSize : 0;
+            return data != nullptr;
+        }
+
+        void Unmap()
+        {
+#if defined(_WIN32)
+            if (data)
+                UnmapViewOfFile(data);
+            if (mapping)
+                CloseHandle(mapping);
+            mapping = nullptr;
+#else
+            if (data)
+                munmap(data, size);
+#endif
+            data = nullptr;
+        }
+    };
+
+    // Appends the inbound events of every session to a memory-mapped log.
+    // Append only pushes into a lock-free ring, without any syscall or lock,
+    // so the network threads never wait on the disk; a background thread
+    // copies the ring into the mapping, which is preallocated and grown by
+    // doubling. A full ring drops the entry and counts it.
+    class Recorder
+    {
+    public:
+        Recorder(const std::string &path, int32_t width, int32_t height, float tickRate, size_t initialEntries = size_t(1) << 20)
+            : ring(new Ring())
+        {
+            if (!file.Open(path, sizeof(RecordHeader) + initialEntries * sizeof(RecordEntry)))
+            {
+                std::cerr << "[RECORDER] Cannot create " << path << ": " << std::strerror(errno) << "\n";
+                return;
+            }
+
+            RecordHeader header;
+            header.width = width;
+            header.height = height;
+            header.tickRate = tickRate;
+            header.startTime = net::protocol::timestampNow();
+            header.wallClock = int64_t(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+            std::memcpy(file.Data(), &header, sizeof(header));
+
+            open = true;
+            writer = std::thread(&Recorder::RunWriter, this);
+            std::cout << "[RECORDER] Recording to " << path << ".\n";
+        }
+
+        ~Recorder()
+        {
+            running = false;
+            if (writer.joinable())
+                writer.join();
+            file.Close(sizeof(RecordHeader) + written * sizeof(RecordEntry));
+        }
+
+        bool IsOpen() const { return open.load(std::memory_order_relaxed); }
+
+        // any thread; false if the entry was dropped
+        bool Append(RecordKind kind, uint32_t session, uint64_t value, uint64_t time)
+        {
+            if (!IsOpen())
+                return false;
+            RecordEntry entry;
+            entry.time = time;
+            entry.session = session;
+            entry.kind = kind;
+            entry.value = value;
+            return ring->push_back(entry);
+        }
+
+        void AppendCommand(uint32_t session, message_t command, uint64_t time)
+        {
+            uint32_t bits;
+            std::memcpy(&bits, &command, sizeof(bits));
+            Append(RecordKind::Command, session, bits, time);
+        }
+
+        uint64_t Dropped() const { return ring->dropped(); }
+
+    private:
+        // spin policy: producers never signal, the writer polls
+        typedef net::mpsc_queue<RecordEntry, size_t(1) << 16, net::wait_policy::spin> Ring;
+
+        std::unique_ptr<Ring> ring;
+        MappedFile file;
+        std::atomic<bool> open{false};
+        std::atomic<bool> running{true};
+        uint64_t written = 0; // writer thread only, until it is joined
+        std::thread writer;
+
+        void RunWriter()
+        {
+            RecordEntry entry;
+            while (running || !ring->empty())
+            {
+                size_t batch = 0;
+                while (ring->try_pop(entry))
+                {
+                    if (!Reserve(written + 1))
+                    {
+                        std::cerr << "[RECORDER] Cannot grow the log, recording stopped.\n";
+                        open = false;
+                        return;
+                    }
+                    std::memcpy(file.Data() + sizeof(RecordHeader) + written * sizeof(RecordEntry), &entry, sizeof(entry));
+                    written++;
+                    batch++;
+                }
+
+                if (batch > 0)
+                {
+                    // published after the entries it counts
+                    std::atomic_thread_fence(std::memory_order_release);
+                    std::memcpy(file.Data() + offsetof(RecordHeader, count), &written, sizeof(written));
+                }
+                else
+                {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                }
+            }
+        }
+
+        bool Reserve(uint64_t entries)
+        {
+            const size_t needed = sizeof(RecordHeader) + size_t(entries) * sizeof(RecordEntry);
+            if (needed <= file.Size())
+                return true;
+            return file.Resize(std::max(needed, 2 * file.Size()));
+        }
+    };
+}
@@ -0,0 +1,262 @@
+#pragma once
+
+#include <fstream>
+#include <iomanip>
+#include "Server.h"
+
+namespace BreakOut
+{
+    // One recorded session played back on a fixed tick clock: tick k steps the
+    // world at open + k * period with the last command received by then, as a
+    // headless worker would, so the same log always gives the same states.
+    // Control codes apply at the first tick after they were received; the world
+    // stays frozen while the session was detached or paused by the client.
+    // Replay is self-consistent, not a copy of the live run: the log has no
+    // pauses for a degraded link and no frame times, so a session that paused
+    // on a poor link or ran in the window (one step per frame) replays
+    // differently from how it played.
+    class ReplaySession
+    {
+    public:
+        ReplaySession(uint32_t id, uint32_t seed, int32_t width, int32_t height, float tickRate, uint64_t openedAt)
+            : id(id), seed(seed), world(width, height, seed), tickPeriod(1.0f / tickRate),
+              tickNs(uint64_t(std::llround(1e9 / double(tickRate)))), opened(openedAt), closed(openedAt)
+        {
+        }
+
+        uint32_t Id() const { return id; }
+        uint32_t Seed() const { return seed; }
+        bool Playing() const { return playing; }
+        bool Finished() const { return finished; }
+        uint64_t Ticks() const { return ticks; }
+        float TickPeriod() const { return tickPeriod; } // s
+        uint64_t Duration() const { return closed - opened; } // ns of recorded session
+        const World &GetWorld() const { return world; }
+
+        // FNV-1a over the state after every tick so far
+        uint64_t Digest() const { return digest; }
+
+        // log order only
+        void Add(const RecordEntry &entry)
+        {
+            events.push_back(entry);
+            closed = std::max(closed, entry.time);
+        }
+
+        // steps one tick; false once the recorded session is over
+        bool Tick()
+        {
+            if (finished)
+                return false;
+
+            const uint64_t now = opened + (ticks + 1) * tickNs;
+            if (now > closed)
+            {
+                finished = true;
+                return false;
+            }
+
+            for (; next < events.size() && events[next].time <= now; ++next)
+                Apply(events[next]);
+            if (finished)
+                return false;
+
+            ticks++;
+            if (restart)
+            {
+                restart = false;
+                playing = true;
+                world.Reset();
+            }
+            // in the order Session::Tick applies them
+            if (hold >= 0)
+                held = hold == 1;
+            hold = -1;
+            if (difficulty != 0)
+                world.SetDifficulty(difficulty);
+            difficulty = 0;
+            if (playing && !detached && !held)
+                world.Step(tickPeriod, command);
+            digest = Hash(digest);
+            return true;
+        }
+
+        // one line of the state, floats in hex so that traces diff bit for bit
+        void Trace(std::ostream &out) const
+        {
+            const std::ios::fmtflags flags = out.flags();
+            out << id << ' ' << ticks << ' ' << playing << std::hexfloat
+                << ' ' << command << ' ' << world.batPos.x
+                << ' ' << world.ballPos.x << ' ' << world.ballPos.y
+                << ' ' << world.ballDir.x << ' ' << world.ballDir.y << ' ' << world.ballSpeed;
+            out.flags(flags);
+            out << ' ' << std::hex << Hash(fnvBasis) << "\n";
+            out.flags(flags);
+        }
+
+    private:
+        static constexpr uint64_t fnvBasis = 14695981039346656037ull;
+
+        uint32_t id;
+        uint32_t seed;
+        World world;
+        float tickPeriod;
+        uint64_t tickNs;
+        uint64_t opened, closed;
+
+        std::vector<RecordEntry> events;
+        size_t next = 0;
+        uint64_t ticks = 0;
+        message_t command = 0;
+        bool restart = true; // as raised by Session's constructor
+        bool playing = false;
+        bool detached = false;
+        bool held = false;
+        int hold = -1;          // pending pause (1) or unpause (0)
+        int32_t difficulty = 0; // pending level, 0 if none
+        bool finished = false;
+        uint64_t digest = fnvBasis;
+
+        void Apply(const RecordEntry &entry)
+        {
+            switch (entry.kind)
+            {
+            case RecordKind::Command:
+            {
+                const uint32_t bits = uint32_t(entry.value);
+                std::memcpy(&command, &bits, sizeof(command));
+                // the legacy end of session sentinel, in logs from before it was recorded as a Stop
+                if (command == -1.0f)
+                    finished = true;
+                break;
+            }
+            case RecordKind::Control:
+                switch (ControlCode(uint32_t(entry.value)))
+                {
+                case ControlCode::Stop:
+                    finished = true;
+                    break;
+                case ControlCode::Restart:
+                    restart = true;
+                    break;
+                case ControlCode::Pause:
+                case ControlCode::Unpause:
+                    hold = ControlCode(uint32_t(entry.value)) == ControlCode::Pause ? 1 : 0;
+                    break;
+                case ControlCode::Difficulty:
+                    difficulty = int32_t(uint32_t(entry.value >> 32));
+                    break;
+                default:
+                    break;
+                }
+                break;
+            case RecordKind::SessionClose:
+                finished = true;
+                break;
+            case RecordKind::SessionDetach:
+                detached = true;
+                break;
+            case RecordKind::SessionResume:
+                detached = false;
+                break;
+            default:
+                break;
+            }
+        }
+
+        uint64_t Hash(uint64_t hash) const
+        {
+            const auto mix = [&hash](const void *data, size_t size) {
+                const uint8_t *bytes = static_cast<const uint8_t *>(data);
+                for (size_t i = 0; i < size; ++i)
+                    hash = (hash ^ bytes[i]) * 1099511628211ull;
+            };
+            const float state[] = {world.batPos.x, world.batPos.y, world.ballPos.x, world.ballPos.y,
+                                   world.ballDir.x, world.ballDir.y, world.ballSpeed};
+            mix(state, sizeof(state));
+            mix(world.blocks.get(), 24 * 30 * sizeof(int));
+            return hash;
+        }
+    };
+
+    // A log written by Recorder, split into its sessions.
+    class Replay
+    {
+    public:
+        // false, with the reason on stderr, if the file is not a readable log
+        bool Load(const std::string &path)
+        {
+            std::ifstream in(path, std::ios::binary);
+            if (!in.read(reinterpret_cast<char *>(&header), sizeof(header)))
+            {
+                std::cerr << "[REPLAY] Cannot read " << path << "\n";
+                return false;
+            }
+            if (std::memcmp(header.magic, RecordHeader().magic, sizeof(header.magic)) != 0 ||
+                header.version != RecordHeader().version || header.entrySize != sizeof(RecordEntry))
+            {
+                std::cerr << "[REPLAY] " << path << " is not a session log of this version\n";
+                return false;
+            }
+            if (header.tickRate <= 0 || header.width <= 0 || header.height <= 0)
+            {
+                std::cerr << "[REPLAY] " << path << " has no valid screen size or tick rate\n";
+                return false;
+            }
+
+            // entries past count were not published when the recorder stopped
+            std::unordered_map<uint32_t, ReplaySession *> open;
+            RecordEntry entry;
+            for (uint64_t i = 0; i < header.count && in.read(reinterpret_cast<char *>(&entry), sizeof(entry)); ++i)
+            {
+                if (entry.kind == RecordKind::SessionOpen)
+                {
+                    sessions.push_back(std::make_unique<ReplaySession>(entry.session, uint32_t(entry.value), header.width,
+                                                                       header.height, header.tickRate, entry.time));
+                    open[entry.session] = sessions.back().get();
+                    continue;
+                }
+
+                if (entry.kind == RecordKind::SessionResume)
+                {
+                    // the session continues under the new id, the one opened for it is dropped
+                    auto resumed = open.find(uint32_t(entry.value));
+                    if (resumed == open.end())
+                        continue;
+                    ReplaySession *session = resumed->second;
+                    open.erase(resumed);
+                    auto fresh = open.find(entry.session);
+                    if (fresh != open.end())
+                        sessions.erase(std::find_if(sessions.begin(), sessions.end(),
+                                                    [&fresh](const std::unique_ptr<ReplaySession> &s) { return s.get() == fresh->second; }));
+                    open[entry.session] = session;
+                    session->Add(entry);
+                    continue;
+                }
+
+                auto it = open.find(entry.session);
+                if (it == open.end())
+                    continue; // opened before the recording started
+                it->second->Add(entry);
+                if (entry.kind == RecordKind::SessionClose)
+                    open.erase(it);
+            }
+            return true;
+        }
+
+        const RecordHeader &Header() const { return header; }
+        std::vector<std::unique_ptr<ReplaySession>> &Sessions() { return sessions; }
+
+        ReplaySession *Find(uint32_t id)
+        {
+            for (auto &session : sessions)
+                if (session->Id() == id)
+                    return session.get();
+            return nullptr;
+        }
+
+    private:
+        RecordHeader header;
+        std::vector<std::unique_ptr<ReplaySession>> sessions;
+    };
+}
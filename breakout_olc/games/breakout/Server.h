@@ -1,43 +1,186 @@
-#include "../../net/net.h"
+#pragma once
 
-typedef float message_t;
+#include "../../net/net.h"
+#include "Session.h"
+#include "Recorder.h"
 
 namespace BreakOut
 {
+    // codes of the net::control_message carried by net::msgType::Control frames;
+    // they are dispatched ahead of the commands queued before them
+    enum class ControlCode : uint32_t
+    {
+        Stop = 1,
+        Restart = 2,
+        Pause = 3,      // freezes the game until Unpause, like a degraded link would
+        Unpause = 4,
+        Difficulty = 5, // arg: level, from 1 (default) to World::maxDifficulty
+    };
+
     class Server : public net::server_interface<message_t>
     {
     public:
-        Server(uint16_t port) : net::server_interface<message_t>(port)
+        Server(uint16_t port, SessionManager &sessionManager, size_t ioThreads = 1, Recorder *sessionRecorder = nullptr)
+            : net::server_interface<message_t>(port, ioThreads), sessions(sessionManager), recorder(sessionRecorder)
         {
-            restartRequested = false;
-            stopRequested = false;
+            // legacy clients end their session with a -1.0 command; the connection turns it into a Stop
+            this->setLegacySentinel(-1.0f, uint32_t(ControlCode::Stop));
         }
 
-        message_t command;
-        bool restartRequested;
-        bool stopRequested;
+        // how long the session of a framed client whose link failed waits, frozen, for the
+        // client to come back with its resume token; 0 ends sessions with their connection
+        void setResumeGrace(std::chrono::milliseconds grace) { this->resumeGrace = grace; }
 
     protected:
         virtual bool onClientConnecting(std::shared_ptr<net::connection<message_t>> client)
         {
-            restartRequested = true;
             std::cout << "Client connecting.\n";
             return true;
         }
 
+        // runs on an asio thread, hence the locking inside the session manager
+        virtual void onClientConnected(std::shared_ptr<net::connection<message_t>> client)
+        {
+            std::shared_ptr<Session> session = this->sessions.Open(client);
+            if (this->recorder)
+                this->recorder->Append(RecordKind::SessionOpen, client->getId(), session->Seed(), net::protocol::timestampNow());
+            std::cout << "Session [" << client->getId() << "] opened, " << this->sessions.Count() << " active.\n";
+        }
+
+        // the link failed: the client may come back for its session
         virtual void onClientDisconnected(std::shared_ptr<net::connection<message_t>> client)
         {
-            stopRequested = true;
+            const uint64_t now = net::protocol::timestampNow();
+            const uint64_t grace = uint64_t(std::chrono::nanoseconds(this->resumeGrace).count());
+            if (grace == 0 || client->getProtocol() != net::protocol_version::framed ||
+                !this->sessions.Detach(client->getId(), client->getToken(), now + grace))
+            {
+                this->endSession(client);
+                return;
+            }
+
+            if (this->recorder)
+                this->recorder->Append(RecordKind::SessionDetach, client->getId(), 0, now);
+            std::cout << "Session [" << client->getId() << "] detached, resumable for " << this->resumeGrace.count() << " ms.\n";
+            this->dropConnection(client);
+
+            auto timer = std::make_shared<asio::steady_timer>(this->context, this->resumeGrace + std::chrono::milliseconds(1));
+            timer->async_wait([this, timer](std::error_code ec) {
+                if (!ec)
+                    this->expireSessions();
+            });
+        }
+
+        virtual void onMessage(std::shared_ptr<net::connection<message_t>> client, message_t msg)
+        {
+            std::shared_ptr<Session> session = this->findSession(client->getId());
+            if (session)
+                session->PostCommand(msg, this->receivedAt, this->sentAt);
+            if (this->recorder)
+                this->recorder->AppendCommand(client->getId(), msg, this->receivedAt);
+            // std::cout << "Command received: " << msg << "\n";
+        }
+
+        virtual void onFrame(std::shared_ptr<net::connection<message_t>> client, const net::owned_message<message_t> &msg)
+        {
+            // dispatched ahead of the client's controls and commands, which all reach the resumed session
+            if (msg.header.id == net::msgType::Hello && msg.body.size() >= 12)
+            {
+                this->resumeSession(client, net::wire::getU64(msg.body.data() + 4));
+                return;
+            }
+            if (msg.header.id != net::msgType::Control || msg.body.size() < net::control_message::size)
+                return;
+
+            const net::control_message control = net::control_message::decode(msg.body.data());
+            if (this->recorder)
+                this->recorder->Append(RecordKind::Control, client->getId(), control.code | uint64_t(uint32_t(control.arg)) << 32,
+                                       this->receivedAt);
+            if (ControlCode(control.code) == ControlCode::Stop)
+            {
+                this->endSession(client);
+                return;
+            }
+
+            std::shared_ptr<Session> session = this->findSession(client->getId());
+            if (!session)
+                return;
+            switch (ControlCode(control.code))
+            {
+            case ControlCode::Restart:
+                session->RaiseControlEvent(ControlEvent::Restart);
+                break;
+            case ControlCode::Pause:
+                session->RaiseControlEvent(ControlEvent::Pause);
+                break;
+            case ControlCode::Unpause:
+                session->RaiseControlEvent(ControlEvent::Unpause);
+                break;
+            case ControlCode::Difficulty:
+                session->SetDifficulty(control.arg);
+                break;
+            default:
+                break;
+            }
+        }
+
+    private:
+        SessionManager &sessions;
+        Recorder *recorder; // not owned, may be null
+        std::shared_ptr<Session> lastSession; // msgs mostly come in runs from the same client
+        std::chrono::milliseconds resumeGrace{0};
+
+        // for good: stopped by the client, legacy, or not resumable
+        void endSession(std::shared_ptr<net::connection<message_t>> client)
+        {
+            this->sessions.Close(client->getId());
+            if (this->recorder)
+                this->recorder->Append(RecordKind::SessionClose, client->getId(), 0, net::protocol::timestampNow());
+            this->dropConnection(client);
+        }
+
+        void dropConnection(std::shared_ptr<net::connection<message_t>> client)
+        {
+            this->lastSession.reset();
             this->removeConnection(client);
             std::cout << "Removing client [" << client->getId() << "]\n";
         }
 
-        virtual void onMessage(std::shared_ptr<net::connection<message_t>> client, message_t msg)
+        // the client sent the token of an earlier connection: it gets that session back, game
+        // state included, in place of the one opened when it connected
+        void resumeSession(std::shared_ptr<net::connection<message_t>> client, uint64_t token)
+        {
+            uint32_t previousId = 0;
+            if (!this->sessions.Resume(token, client, net::protocol::timestampNow(), previousId))
+            {
+                std::cout << "Session [" << client->getId() << "] could not resume: unknown or expired token.\n";
+                return;
+            }
+
+            this->lastSession.reset();
+            if (std::shared_ptr<net::connection<message_t>> previous = this->findConnection(previousId))
+                this->removeConnection(previous); // its failure was not noticed yet
+            if (this->recorder)
+                this->recorder->Append(RecordKind::SessionResume, client->getId(), previousId, this->receivedAt);
+            std::cout << "Session [" << previousId << "] resumed by client [" << client->getId() << "].\n";
+        }
+
+        // asio thread, once a grace period is over
+        void expireSessions()
+        {
+            for (uint32_t id : this->sessions.Expire(net::protocol::timestampNow()))
+            {
+                if (this->recorder)
+                    this->recorder->Append(RecordKind::SessionClose, id, 0, net::protocol::timestampNow());
+                std::cout << "Session [" << id << "] expired, its client did not come back.\n";
+            }
+        }
+
+        std::shared_ptr<Session> findSession(uint32_t id)
         {
-            command = msg;
-            // std::cout << "Command received: " << command << "\n";
-            if (msg == -1.0)
-                this->onClientDisconnected(client);
+            if (!this->lastSession || this->lastSession->Id() != id)
+                this->lastSession = this->sessions.Find(id);
+            return this->lastSession;
         }
     };
 }
@@ -0,0 +1,484 @@
+#pragma once
+
+#include "../../net/net.h"
+#include "World.h"
+#include "Latency.h"
+
+typedef float message_t;
+
+namespace net
+{
+    // the 16 bytes telemetry of the Unity TcpServer: four big-endian floats
+    template <>
+    struct wire_codec<BreakOut::Feedback>
+    {
+        static constexpr size_t size = 16;
+
+        static void encode(uint8_t *out, const BreakOut::Feedback &feedback)
+        {
+            endian::storeFields<endian::network>(out, feedback.paddleActual, feedback.paddleDesired,
+                                                 feedback.ballDistance, feedback.ballProximity);
+        }
+
+        static BreakOut::Feedback decode(const uint8_t *in)
+        {
+            BreakOut::Feedback feedback;
+            endian::loadFields<endian::network>(in, feedback.paddleActual, feedback.paddleDesired,
+                                                feedback.ballDistance, feedback.ballProximity);
+            return feedback;
+        }
+    };
+} // namespace net
+
+namespace BreakOut
+{
+    // latest paddle command, as published by the server thread
+    struct CommandSample
+    {
+        message_t value = 0;                            // raw command, expected in [0, 1]
+        uint64_t sequence = 0;                          // number of commands received so far
+        uint64_t received = 0;                          // when its bytes were decoded (net::protocol::timestampNow)
+        uint64_t sent = 0;                              // when the robot sent it, on the same clock; 0 if unknown
+    };
+
+    enum ControlEvent : uint32_t
+    {
+        Restart = 1 << 0,
+        Stop = 1 << 1,
+        Pause = 1 << 2,
+        Unpause = 1 << 3,
+        Difficulty = 1 << 4, // level posted with SetDifficulty
+    };
+
+    // One patient: a connection, its command mailbox and its own game state.
+    // Commands and control events are posted by the server thread; Tick and the
+    // world are only ever touched by the single thread that owns the session
+    // (the engine thread for the windowed session, a worker for headless ones).
+    // A headless session promoted to a freed window changes owner between ticks.
+    // The game freezes while the connection is down, until the client resumes
+    // the session on a new one (Reattach) or the session is closed.
+    class Session
+    {
+    public:
+        Session(std::shared_ptr<net::connection<message_t>> connection, int32_t width, int32_t height, uint32_t seed,
+                LatencyStats *latencyStats = nullptr)
+            : client(std::move(connection)), seed(seed), world(width, height, seed), latency(latencyStats)
+        {
+            id = client->getId();
+            RaiseControlEvent(ControlEvent::Restart);
+        }
+
+        net::mailbox<CommandSample> command;
+
+        uint32_t Id() const { return id.load(std::memory_order_relaxed); } // of the current connection
+        uint32_t Seed() const { return seed; }
+        bool Playing() const { return playing; }
+        bool Paused() const { return paused; } // by the last tick, held or for a degraded or lost link
+        bool Held() const { return held; }     // paused by the client itself
+
+        // the connection currently attached; the copy keeps it alive across a Reattach
+        std::shared_ptr<net::connection<message_t>> Connection() const
+        {
+            const std::lock_guard<std::mutex> lock(clientMtx);
+            return client;
+        }
+        const World &GetWorld() const { return world; }
+
+        // the command used by the last tick, and whether that tick was the first to use it
+        const CommandSample &Consumed() const { return consumed; }
+        bool ConsumedNew() const { return consumedNew; }
+        uint64_t ConsumedAt() const { return consumedAt; }
+
+        // server thread only
+        void PostCommand(message_t value, uint64_t received, uint64_t sent = 0)
+        {
+            CommandSample sample;
+            sample.value = value;
+            sample.sequence = ++commandsReceived;
+            sample.received = received;
+            sample.sent = sent;
+            command.store(sample);
+            if (latency && sent != 0 && received > sent)
+                latency->Stage(LatencyStage::Link).record(received - sent);
+        }
+
+        // server thread only: hands the session over to the connection of a resuming client
+        void Reattach(std::shared_ptr<net::connection<message_t>> connection)
+        {
+            const std::lock_guard<std::mutex> lock(clientMtx);
+            id = connection->getId();
+            client = std::move(connection);
+        }
+
+        // server thread only: the level applies at the next tick
+        void SetDifficulty(int32_t level)
+        {
+            difficulty.store(level, std::memory_order_relaxed);
+            RaiseControlEvent(ControlEvent::Difficulty);
+        }
+
+        // a restart cancels a pending stop and a pause a pending unpause, and vice versa,
+        // so the session only sees the latest
+        void RaiseControlEvent(ControlEvent event)
+        {
+            const uint32_t opposite = event == ControlEvent::Restart ? uint32_t(ControlEvent::Stop)
+                                      : event == ControlEvent::Stop  ? uint32_t(ControlEvent::Restart)
+                                      : event == ControlEvent::Pause ? uint32_t(ControlEvent::Unpause)
+                                      : event == ControlEvent::Unpause ? uint32_t(ControlEvent::Pause)
+                                                                       : uint32_t(0);
+            uint32_t current = controlEvents.load(std::memory_order_relaxed);
+            while (!controlEvents.compare_exchange_weak(current, (current & ~opposite) | event,
+                                                        std::memory_order_release, std::memory_order_relaxed))
+                ;
+        }
+
+        // owner thread only: applies pending control events, steps the world and reports back
+        void Tick(float elapsedTime)
+        {
+            uint32_t events = controlEvents.exchange(0, std::memory_order_acquire);
+            if (events & ControlEvent::Restart)
+            {
+                playing = true;
+                world.Reset();
+            }
+            if (events & ControlEvent::Stop)
+            {
+                playing = false;
+            }
+            if (events & (ControlEvent::Pause | ControlEvent::Unpause))
+                held = (events & ControlEvent::Pause) != 0;
+            if (events & ControlEvent::Difficulty)
+                world.SetDifficulty(difficulty.load(std::memory_order_relaxed));
+            if (!playing)
+                return;
+
+            // hold the game rather than play on late or missing commands
+            const std::shared_ptr<net::connection<message_t>> connection = Connection();
+            paused = held || !connection->isConnected() || connection->linkStats().degraded(net::protocol::timestampNow());
+            if (paused)
+                return;
+
+            ConsumeCommand();
+            world.Step(elapsedTime, consumed.value);
+            SendFeedback(*connection, world.ComputeFeedback());
+        }
+
+    private:
+        mutable std::mutex clientMtx; // guards client, replaced by Reattach
+        std::shared_ptr<net::connection<message_t>> client;
+        std::atomic<uint32_t> id{0};
+        uint32_t seed;
+        World world;
+        bool playing = false;
+        bool paused = false;
+        bool held = false;
+
+        std::atomic<uint32_t> controlEvents{0};
+        std::atomic<int32_t> difficulty{1};
+        uint64_t commandsReceived = 0;
+
+        LatencyStats *latency;
+        GameMetrics &metrics = GameMetrics::Get();
+        CommandSample consumed;
+        bool consumedNew = false;
+        uint64_t consumedAt = 0;
+
+        void ConsumeCommand()
+        {
+            const uint64_t previous = consumed.sequence;
+            consumed = command.load();
+            consumedNew = consumed.sequence != previous;
+            if (!consumedNew)
+                return;
+
+            consumedAt = net::protocol::timestampNow();
+            metrics.commandsConsumed.add();
+            if (consumed.sequence > previous + 1)
+                metrics.commandsOverwritten.add(consumed.sequence - previous - 1);
+            if (latency && consumed.received != 0)
+                latency->Stage(LatencyStage::Queue).record(consumedAt - consumed.received);
+        }
+
+        // sends the same 16 bytes payload as the Unity TcpServer (four big-endian floats),
+        // framed as Telemetry for clients using the framed protocol
+        void SendFeedback(net::connection<message_t> &client, const Feedback &feedback)
+        {
+            if (!client.isConnected())
+                return;
+
+            net::message<message_t> msg;
+            msg.header.id = net::msgType::Telemetry;
+            msg.header.channel = net::msgChannel::telemetry;
+            msg.encode(feedback);
+            client.send(msg);
+        }
+    };
+
+    // Maps connections to sessions. With a window, the first session to arrive while
+    // the window is free is shown and stepped by the engine; every other session runs
+    // headless on a pool of workers, each stepping its share at a fixed tick rate.
+    // When the windowed session closes, the headless one connected longest takes
+    // its place, so a client that reconnects before its old connection was closed
+    // still ends up in the window.
+    // A detached session keeps its place (and stays frozen) until it is resumed
+    // with the token of its last connection or expires.
+    class SessionManager
+    {
+    public:
+        SessionManager(int32_t width, int32_t height, size_t workerCount, float tickRate, bool windowed)
+            : screenWidth(width), screenHeight(height), tickPeriod(1.0f / tickRate), hasWindow(windowed)
+        {
+            for (size_t i = 0; i < std::max<size_t>(workerCount, 1); ++i)
+                workers.push_back(std::make_unique<Worker>());
+            for (auto &worker : workers)
+                worker->thread = std::thread(&SessionManager::RunWorker, this, std::ref(*worker));
+            net::metrics_registry::global().sampled("game_sessions_active", "Sessions open, windowed or headless.",
+                                                    net::metric_type::gauge, [this]() { return double(Count()); });
+        }
+
+        ~SessionManager()
+        {
+            net::metrics_registry::global().removeSampled("game_sessions_active");
+            running = false;
+            for (auto &worker : workers)
+                if (worker->thread.joinable())
+                    worker->thread.join();
+        }
+
+        std::shared_ptr<Session> Open(std::shared_ptr<net::connection<message_t>> client)
+        {
+            const std::lock_guard<std::mutex> lock(mtx);
+            auto session = std::make_shared<Session>(client, screenWidth, screenHeight, seeder(), &latency);
+            sessions[session->Id()] = session;
+            if (hasWindow && !windowedSession)
+            {
+                windowedSession = session;
+                return session;
+            }
+
+            Worker *leastLoaded = workers.front().get();
+            for (auto &worker : workers)
+                if (worker->load < leastLoaded->load)
+                    leastLoaded = worker.get();
+
+            const std::lock_guard<std::mutex> workerLock(leastLoaded->mtx);
+            leastLoaded->sessions.push_back(session);
+            leastLoaded->load++;
+            return session;
+        }
+
+        void Close(uint32_t id)
+        {
+            const std::lock_guard<std::mutex> lock(mtx);
+            auto it = sessions.find(id);
+            if (it == sessions.end())
+                return;
+
+            Remove(it->second);
+            sessions.erase(it);
+        }
+
+        // keeps the session of a lost connection for its client to resume with token until
+        // deadline (net::protocol::timestampNow clock); false if the connection has no session
+        // or no token
+        bool Detach(uint32_t id, uint64_t token, uint64_t deadline)
+        {
+            if (token == 0)
+                return false; // no token was drawn, nothing could resume it
+            const std::lock_guard<std::mutex> lock(mtx);
+            auto it = sessions.find(id);
+            if (it == sessions.end())
+                return false;
+
+            detached[token] = DetachedSession{it->second, deadline};
+            sessions.erase(it);
+            return true;
+        }
+
+        // hands the session of token over to client, closing the one opened for client
+        // meanwhile; null if the token is unknown or expired, else previousId is the id of
+        // the session's last connection. The session may still be attached to that
+        // connection, if the client saw the link fail before the server did
+        std::shared_ptr<Session> Resume(uint64_t token, std::shared_ptr<net::connection<message_t>> client, uint64_t now,
+                                        uint32_t &previousId)
+        {
+            const std::lock_guard<std::mutex> lock(mtx);
+            std::shared_ptr<Session> session;
+            auto it = detached.find(token);
+            if (it != detached.end())
+            {
+                if (it->second.deadline < now)
+                    return nullptr;
+                session = it->second.session;
+                detached.erase(it);
+            }
+            else
+            {
+                auto attached = std::find_if(sessions.begin(), sessions.end(), [&](const auto &entry) {
+                    return entry.first != client->getId() && entry.second->Connection()->getToken() == token;
+                });
+                if (attached == sessions.end())
+                    return nullptr;
+                session = attached->second;
+                sessions.erase(attached);
+            }
+
+            auto fresh = sessions.find(client->getId());
+            if (fresh != sessions.end())
+            {
+                Remove(fresh->second);
+                sessions.erase(fresh);
+            }
+
+            previousId = session->Id();
+            session->Reattach(client);
+            sessions[client->getId()] = session;
+            return session;
+        }
+
+        // closes the detached sessions past their deadline, returns their (last) ids
+        std::vector<uint32_t> Expire(uint64_t now)
+        {
+            const std::lock_guard<std::mutex> lock(mtx);
+            std::vector<uint32_t> expired;
+            for (auto it = detached.begin(); it != detached.end();)
+            {
+                if (it->second.deadline >= now)
+                {
+                    ++it;
+                    continue;
+                }
+                expired.push_back(it->second.session->Id());
+                Remove(it->second.session);
+                it = detached.erase(it);
+            }
+            return expired;
+        }
+
+        std::shared_ptr<Session> Find(uint32_t id)
+        {
+            const std::lock_guard<std::mutex> lock(mtx);
+            auto it = sessions.find(id);
+            return it != sessions.end() ? it->second : nullptr;
+        }
+
+        // the session shown in the window, if any
+        std::shared_ptr<Session> Windowed()
+        {
+            const std::lock_guard<std::mutex> lock(mtx);
+            return windowedSession;
+        }
+
+        // attached or detached
+        size_t Count()
+        {
+            const std::lock_guard<std::mutex> lock(mtx);
+            return sessions.size() + detached.size();
+        }
+
+        // command latencies of every session (the render stages only for the windowed one)
+        LatencyStats &Latency() { return latency; }
+
+    private:
+        struct Worker
+        {
+            std::thread thread;
+            std::mutex mtx;
+            std::mutex passMtx; // held from taking the pass's snapshot to its last tick
+            std::vector<std::shared_ptr<Session>> sessions;
+            size_t load = 0; // guarded by SessionManager::mtx
+        };
+
+        int32_t screenWidth, screenHeight;
+        float tickPeriod;
+        bool hasWindow;
+        LatencyStats latency;
+
+        struct DetachedSession
+        {
+            std::shared_ptr<Session> session;
+            uint64_t deadline = 0;
+        };
+
+        std::mutex mtx;
+        std::unordered_map<uint32_t, std::shared_ptr<Session>> sessions; // by id of the attached connection
+        std::unordered_map<uint64_t, DetachedSession> detached;          // by resume token
+        std::shared_ptr<Session> windowedSession;
+        std::random_device seeder;
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<bool> running{true};
+        GameMetrics &metrics = GameMetrics::Get();
+
+        // takes the session off the window or its worker; a freed window goes to the
+        // attached headless session with the oldest connection, if any; mtx held
+        void Remove(const std::shared_ptr<Session> &session)
+        {
+            if (windowedSession != session)
+            {
+                TakeOffWorker(session);
+                return;
+            }
+
+            windowedSession.reset();
+            std::shared_ptr<Session> promoted;
+            for (auto &entry : sessions)
+                if (entry.second != session && (!promoted || entry.first < promoted->Id()))
+                    promoted = entry.second;
+            if (!promoted)
+                return;
+
+            // the worker may be ticking it right now: the engine takes over after that pass
+            Worker *previousOwner = TakeOffWorker(promoted);
+            if (previousOwner)
+            {
+                const std::lock_guard<std::mutex> passLock(previousOwner->passMtx);
+            }
+            windowedSession = promoted;
+        }
+
+        // the worker the session was on, null if none; mtx held
+        Worker *TakeOffWorker(const std::shared_ptr<Session> &session)
+        {
+            for (auto &worker : workers)
+            {
+                const std::lock_guard<std::mutex> workerLock(worker->mtx);
+                auto found = std::find(worker->sessions.begin(), worker->sessions.end(), session);
+                if (found != worker->sessions.end())
+                {
+                    worker->sessions.erase(found);
+                    worker->load--;
+                    return worker.get();
+                }
+            }
+            return nullptr;
+        }
+
+        void RunWorker(Worker &worker)
+        {
+            const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(tickPeriod));
+            std::vector<std::shared_ptr<Session>> ticking;
+            auto next = std::chrono::steady_clock::now();
+            while (running)
+            {
+                const uint64_t tickStart = net::protocol::timestampNow();
+                {
+                    const std::lock_guard<std::mutex> passLock(worker.passMtx);
+                    {
+                        const std::lock_guard<std::mutex> lock(worker.mtx);
+                        ticking.assign(worker.sessions.begin(), worker.sessions.end());
+                    }
+                    for (auto &session : ticking)
+                        session->Tick(tickPeriod);
+                }
+                if (!ticking.empty())
+                    metrics.workerTick.observe(net::protocol::timestampNow() - tickStart);
+                ticking.clear();
+
+                // skip the ticks we are late for rather than bursting to catch up
+                next = std::max(next + period, std::chrono::steady_clock::now() - period);
+                std::this_thread::sleep_until(next);
+            }
+        }
+    };
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <random>
+#include "../../olc/olcPixelGameEngine.h"
+
+namespace BreakOut
+{
+    // what the game reports back to the robot every frame, all normalized in [0, 1]
+    struct Feedback
+    {
+        float paddleActual = 0;  // current paddle position
+        float paddleDesired = 0; // paddle position that would catch the ball
+        float ballDistance = 0;  // ball to paddle distance over the screen diagonal
+        float ballProximity = 0; // 1 - vertical ball to paddle distance, 0 beyond the deadband
+    };
+
+    // Game state and physics, without any rendering, so that it can be stepped
+    // by the engine thread for the windowed session or by a worker for headless ones.
+    class World
+    {
+    public:
+        World(int32_t width, int32_t height, uint32_t seed) : screenWidth(width), screenHeight(height), rng(seed)
+        {
+            Reset();
+        }
+
+        olc::vf2d batPos, batDim;
+
+        olc::vf2d ballPos, ballDir;
+        float ballSpeed, ballRadius, ballAcceleration;
+
+        olc::vi2d blockSize;
+        std::unique_ptr<int[]> blocks;
+
+        int32_t ScreenWidth() const { return screenWidth; }
+        int32_t ScreenHeight() const { return screenHeight; }
+
+        void Reset()
+        {
+            CreateWorld();
+            Init();
+        }
+
+        // 1 is the default game, each level above it plays the ball half as fast again;
+        // applies to the ball in flight as well as to the next ones
+        void SetDifficulty(int32_t level)
+        {
+            const float scale = 1.0f + 0.5f * float(std::max(1, std::min(maxDifficulty, level)) - 1);
+            ballSpeed *= scale / speedScale;
+            ballAcceleration *= scale / speedScale;
+            speedScale = scale;
+        }
+
+        static constexpr int32_t maxDifficulty = 5;
+
+        void Step(float elapsedTime, float command)
+        {
+            // Update Bat position as commanded by the server
+            float p = std::max(0.0f, std::min(1.0f, command));
+            batPos.x = blockSize.x + p * (ScreenWidth() - 2 * blockSize.x - batDim.x);
+
+            // Calculate where ball should be, if no collision
+            olc::vf2d potentialBallPos = ballPos + ballDir * ballSpeed * elapsedTime;
+
+            // Test for hits 4 points around ball
+            olc::vf2d tileBallRadialDims = {ballRadius / blockSize.x, ballRadius / blockSize.y};
+            bool tileHit = false;
+            tileHit |= TestResolveCollisionPoint(olc::vf2d(0, -1), potentialBallPos, tileBallRadialDims);
+            tileHit |= TestResolveCollisionPoint(olc::vf2d(0, +1), potentialBallPos, tileBallRadialDims);
+            tileHit |= TestResolveCollisionPoint(olc::vf2d(-1, 0), potentialBallPos, tileBallRadialDims);
+            tileHit |= TestResolveCollisionPoint(olc::vf2d(+1, 0), potentialBallPos, tileBallRadialDims);
+
+            // Actually update ball position with modified direction
+            ballPos += ballDir * ballSpeed * elapsedTime;
+            ballSpeed += ballAcceleration * elapsedTime;
+
+            // Check Bat vs Ball collision
+            olc::vf2d trueBallPos = {ballPos.x * float(blockSize.x), ballPos.y * float(blockSize.y)};
+            if ((trueBallPos.y + ballRadius >= batPos.y) && (trueBallPos.x >= batPos.x) && (trueBallPos.x <= batPos.x + batDim.x))
+            {
+                // invert y
+                ballDir.y *= -1.0f;
+
+                // modulate x based on impact distance from bat center - delta goes from -1 to 1
+                float delta = (trueBallPos.x - (batPos.x + batDim.x / 2.0f)) / (batDim.x / 2.0f) * (ballDir.x > 0.0f ? 1.0f : -1.0f);
+                ballDir.x += ballDir.x * delta / 1.33f;
+                ballDir = ballDir.norm();
+            }
+
+            // avoid zero horizontal velocity
+            while (std::abs(ballDir.x) <= 0.005f)
+            {
+                ballDir.x += Random() - 0.5f;
+                ballDir = ballDir.norm();
+            }
+
+            // avoid zero vertical velocity
+            while (std::abs(ballDir.y) <= 0.005f)
+            {
+                ballDir.y -= (0.05f + Random());
+                ballDir = ballDir.norm();
+            }
+
+            // Check if game lost - Ball below Bat
+            if (trueBallPos.y - ballRadius > batPos.y + batDim.y)
+                Reset(); // restart game
+        }
+
+        Feedback ComputeFeedback() const
+        {
+            const float batRange = ScreenWidth() - 2 * blockSize.x - batDim.x;
+            const olc::vf2d trueBallPos = {ballPos.x * float(blockSize.x), ballPos.y * float(blockSize.y)};
+            const olc::vf2d batCenter = {batPos.x + batDim.x / 2.0f, batPos.y};
+            const float deadband = 0.5f * ScreenHeight();
+
+            Feedback feedback;
+            feedback.paddleActual = (batPos.x - blockSize.x) / batRange;
+            feedback.paddleDesired = std::max(0.0f, std::min(1.0f, (trueBallPos.x - blockSize.x - batDim.x / 2.0f) / batRange));
+            feedback.ballDistance = (trueBallPos - batCenter).mag() / olc::vf2d(float(ScreenWidth()), float(ScreenHeight())).mag();
+            feedback.ballProximity = std::max(0.0f, 1.0f - (batCenter.y - trueBallPos.y) / deadband);
+            return feedback;
+        }
+
+    private:
+        int32_t screenWidth, screenHeight;
+        std::mt19937 rng; // per world, so that sessions on different threads never share it
+        float speedScale = 1.0f; // of the difficulty level
+
+        // uniform in [0, 1]
+        float Random()
+        {
+            return std::uniform_real_distribution<float>(0.0f, 1.0f)(rng);
+        }
+
+        void Init()
+        {
+            batPos = {20.0f, float(ScreenHeight()) - blockSize.y * 5.0f};
+            batDim = {60.0f, 10.0f};
+
+            ballSpeed = 7.0f * speedScale;
+            ballRadius = 5.0f;
+            ballAcceleration = 0.1f * speedScale;
+
+            // Start Ball - always pointing downwards
+            float margin = 0.75f;
+            float a = Random() * (3.14159f - 2 * margin) + margin;
+            ballDir = {std::cos(a), std::sin(a)};
+            ballPos = {12.5f, 13.5f};
+        }
+
+        void CreateWorld()
+        {
+            blockSize = {int(ScreenWidth() / 24.0f), int(ScreenHeight() / 30.0f)};
+            blocks = std::make_unique<int[]>(24 * 30);
+            for (int y = 0; y < 30; y++)
+            {
+                for (int x = 0; x < 24; x++)
+                {
+                    if (x == 0 || y == 0 || x == 23 || y == 29)
+                        blocks[y * 24 + x] = 10;
+                    else
+                        blocks[y * 24 + x] = 0;
+
+                    if (x > 2 && x <= 20 && y > 3 && y <= 5)
+                        blocks[y * 24 + x] = 1;
+                    if (x > 2 && x <= 20 && y > 5 && y <= 7)
+                        blocks[y * 24 + x] = 2;
+                    if (x > 2 && x <= 20 && y > 7 && y <= 9)
+                        blocks[y * 24 + x] = 3;
+                }
+            }
+        }
+
+        bool TestResolveCollisionPoint(const olc::vf2d &point, olc::vf2d potentialBallPos, olc::vf2d tileBallRadialDims)
+        {
+            olc::vi2d testPoint = potentialBallPos + tileBallRadialDims * point;
+
+            auto &tile = blocks[testPoint.y * 24 + testPoint.x];
+            if (tile == 0)
+            {
+                // Do Nothing, no collision
+                return false;
+            }
+            else
+            {
+                // Ball has collided with a tile
+                bool tileHit = tile < 10;
+                if (tileHit)
+                    tile--;
+
+                // Collision response
+                if (point.x == 0.0f)
+                    ballDir.y *= -1.0f;
+                if (point.y == 0.0f)
+                    ballDir.x *= -1.0f;
+
+                // randomize
+                if (tile != 10)
+                {
+                    ballDir.x += (Random() - 0.5f) * 0.3f * tile;
+                    ballDir.y += (Random() - 0.5f) * 0.3f * tile;
+                    ballDir = ballDir.norm();
+                }
+
+                return tileHit;
+            }
+        }
+    };
+}
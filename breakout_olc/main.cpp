@@ -1,3 +1,4 @@
+#include <fstream>
 #include <iostream>
 #include <string>
 
@@ -10,6 +11,16 @@ void runServer(BreakOut::Server *server, size_t maxMessages, bool wait)
         server->update(maxMessages, wait);
 }
 
+void runLatencyReport(BreakOut::LatencyStats *stats, BreakOut::Server *server, float period)
+{
+    while (1)
+    {
+        std::this_thread::sleep_for(std::chrono::duration<float>(period));
+        stats->Dump(std::cout);
+        server->dumpJitter(std::cout);
+    }
+}
+
 void runGame(BreakOut::Game *game, int32_t screen_w, int32_t screen_h, int32_t pixel_sz)
 {
     if (game->Construct(screen_w, screen_h, pixel_sz, pixel_sz))
@@ -18,30 +29,177 @@ void runGame(BreakOut::Game *game, int32_t screen_w, int32_t screen_h, int32_t p
         std::cout << "Game launch failed.\n";
 }
 
+// Headless replay of every session of a log, as fast as the world steps: prints the
+// digest of each session's states, and with a trace path every state too.
+int runReplayHeadless(BreakOut::Replay &replay, uint32_t only, const std::string &tracePath)
+{
+    std::ofstream trace;
+    if (!tracePath.empty())
+        trace.open(tracePath);
+
+    uint64_t ticks = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (auto &session : replay.Sessions())
+    {
+        if (only != 0 && session->Id() != only)
+            continue;
+        while (session->Tick())
+            if (trace.is_open())
+                session->Trace(trace);
+        ticks += session->Ticks();
+        std::cout << "Session [" << session->Id() << "] seed " << session->Seed() << ": " << session->Ticks()
+                  << " ticks, digest " << std::hex << session->Digest() << std::dec << "\n";
+    }
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Replayed " << ticks << " ticks in " << elapsed << " s ("
+              << (elapsed > 0 ? double(ticks) / elapsed / replay.Header().tickRate : 0) << "x real time).\n";
+    return 0;
+}
+
+// Windowed replay of one session (the first of the log unless given), at speed times real time.
+int runReplayWindowed(BreakOut::Replay &replay, uint32_t only, float speed, int32_t pixel_sz)
+{
+    BreakOut::ReplaySession *session = only != 0 ? replay.Find(only)
+                                                 : (replay.Sessions().empty() ? nullptr : replay.Sessions().front().get());
+    if (!session)
+    {
+        std::cout << "No such session in the log.\n";
+        return -1;
+    }
+
+    BreakOut::ReplayViewer viewer(session, speed);
+    if (viewer.Construct(replay.Header().width, replay.Header().height, pixel_sz, pixel_sz))
+        viewer.Start();
+    else
+        std::cout << "Replay launch failed.\n";
+    return 0;
+}
+
+// value of an optional "--name=value" argument, or fallback if not given
+std::string getOption(int argc, char *argv[], const std::string &name, const std::string &fallback)
+{
+    const std::string prefix = "--" + name + "=";
+    for (int i = 5; i < argc; ++i)
+        if (std::string(argv[i]).compare(0, prefix.size(), prefix) == 0)
+            return std::string(argv[i]).substr(prefix.size());
+    return fallback;
+}
+
+// whether an optional "--name" flag is given
+bool hasFlag(int argc, char *argv[], const std::string &name)
+{
+    for (int i = 5; i < argc; ++i)
+        if (argv[i] == "--" + name)
+            return true;
+    return false;
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc != 5)
+    if (argc < 5)
     {
         std::cout << "Invalid number of arguments. Arguments must be:\n"
                   << "- server port\n"
                   << "- screen width\n"
                   << "- screen height\n"
-                  << "- pixel size\n";
+                  << "- pixel size\n"
+                  << "optionally followed by:\n"
+                  << "- --workers=N: threads stepping headless sessions (default: number of cores when headless, 1 with a window)\n"
+                  << "- --tick-rate=HZ: update rate of headless sessions (default: 60)\n"
+                  << "- --io-threads=N: threads running the network i/o (default: 1)\n"
+                  << "- --udp: also accept paddle commands as datagrams on the server port\n"
+                  << "- --latency-report=SECONDS: periodically print command latency percentiles\n"
+                  << "- --reactor: network i/o and dispatch on the engine thread, once per frame (not headless)\n"
+                  << "- --busy-poll=CPU: network i/o spinning on that cpu, SCHED_FIFO when permitted (not with --reactor)\n"
+                  << "- --coroutines: connection reads, writes and accepts as asio coroutines (C++20 builds)\n"
+                  << "- --heartbeat=MS: ping every client at that interval, pausing its game while the link is degraded\n"
+                  << "- --link-timeout=MS: drop a client silent for that long (with --heartbeat)\n"
+                  << "- --rtt-limit=MS: smoothed rtt above which the link is degraded (default: 100)\n"
+                  << "- --resume-grace=MS: a framed client whose link failed may resume its frozen session for that long (default: 5000, 0: off)\n"
+                  << "- --metrics=PORT: serve counters, queue depths and frame times at http://127.0.0.1:PORT/metrics (Prometheus)\n"
+                  << "- --record=FILE: log every session's commands to FILE, for review and replay\n"
+                  << "- --replay=FILE: no server, play back the sessions of a --record log (screen size from the log)\n"
+                  << "- --replay-session=ID: only that session of the log (default: all headless, the first windowed)\n"
+                  << "- --replay-speed=X: windowed replay at X times real time (default: 1)\n"
+                  << "- --trace=FILE: headless replay writes every tick's state to FILE\n"
+                  << "- --headless: no window, every session runs on the workers (replay: as fast as possible)\n";
         system("pause");
         return -1;
     }
 
+    int32_t screen_w = atoi(argv[2]);
+    int32_t screen_h = atoi(argv[3]);
+    int32_t pixel_sz = atoi(argv[4]);
+    bool headless = hasFlag(argc, argv, "headless");
+    // with a window the usual single patient is on the engine thread, so one worker is
+    // enough for the odd extra session; a headless server scales with the cores
+    const unsigned defaultWorkers = headless ? std::max(1u, std::thread::hardware_concurrency()) : 1u;
+    size_t workers = std::stoul(getOption(argc, argv, "workers", std::to_string(defaultWorkers)));
+    float tickRate = std::stof(getOption(argc, argv, "tick-rate", "60"));
+    size_t ioThreads = std::stoul(getOption(argc, argv, "io-threads", "1"));
+    float latencyReport = std::stof(getOption(argc, argv, "latency-report", "0"));
+    bool reactor = hasFlag(argc, argv, "reactor");
+    if (reactor && headless)
+    {
+        std::cout << "--reactor needs the engine loop, ignored when headless.\n";
+        reactor = false;
+    }
+
+    const std::string replayPath = getOption(argc, argv, "replay", "");
+    if (!replayPath.empty())
+    {
+        BreakOut::Replay replay;
+        if (!replay.Load(replayPath))
+            return -1;
+        const uint32_t only = std::stoul(getOption(argc, argv, "replay-session", "0"));
+        if (headless)
+            return runReplayHeadless(replay, only, getOption(argc, argv, "trace", ""));
+        return runReplayWindowed(replay, only, std::stof(getOption(argc, argv, "replay-speed", "1")), pixel_sz);
+    }
+
+    // sessions are stepped by the window (first one) or by the workers (the others)
+    BreakOut::SessionManager sessions(screen_w, screen_h, workers, tickRate, !headless);
+
     // start server on a thread
     uint16_t port = atoi(argv[1]);
-    BreakOut::Server *server = new BreakOut::Server(port);
-    std::thread server_thread(runServer, server, -1, true);
+    std::unique_ptr<BreakOut::Recorder> recorder;
+    const std::string recordPath = getOption(argc, argv, "record", "");
+    if (!recordPath.empty())
+        recorder = std::make_unique<BreakOut::Recorder>(recordPath, screen_w, screen_h, tickRate);
+    BreakOut::Server *server = new BreakOut::Server(port, sessions, ioThreads, recorder.get());
+    server->setUdpEnabled(hasFlag(argc, argv, "udp"));
+    server->setBusyPoll(std::stoi(getOption(argc, argv, "busy-poll", "-1")));
+    if (hasFlag(argc, argv, "coroutines"))
+    {
+#if defined(ASIO_HAS_CO_AWAIT)
+        server->setReceiveMode(net::receive_mode::coroutine);
+#else
+        std::cout << "--coroutines needs a C++20 build with coroutine support, ignored.\n";
+#endif
+    }
+    server->setMetricsPort(uint16_t(std::stoi(getOption(argc, argv, "metrics", "0"))));
+    net::heartbeat_config heartbeat;
+    heartbeat.interval = std::chrono::milliseconds(std::stoi(getOption(argc, argv, "heartbeat", "0")));
+    heartbeat.timeout = std::chrono::milliseconds(std::stoi(getOption(argc, argv, "link-timeout", "0")));
+    heartbeat.rttLimit = std::chrono::milliseconds(std::stoi(getOption(argc, argv, "rtt-limit", "100")));
+    server->setHeartbeat(heartbeat);
+    server->setResumeGrace(std::chrono::milliseconds(std::stoi(getOption(argc, argv, "resume-grace", "5000"))));
+    std::thread server_thread;
+    if (reactor)
+        server->start(false);
+    else
+        server_thread = std::thread(runServer, server, -1, true);
+
+    if (latencyReport > 0)
+        std::thread(runLatencyReport, &sessions.Latency(), server, latencyReport).detach();
 
     // start game
-    BreakOut::Game game(server);
-    int32_t screen_w = atoi(argv[2]);
-    int32_t screen_h = atoi(argv[3]);
-    int32_t pixel_sz = atoi(argv[4]);
-    runGame(&game, screen_w, screen_h, pixel_sz);
+    if (!headless)
+    {
+        BreakOut::Game game(&sessions, reactor ? server : nullptr);
+        runGame(&game, screen_w, screen_h, pixel_sz);
+    }
 
     if (server_thread.joinable())
         server_thread.join();
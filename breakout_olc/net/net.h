@@ -2,7 +2,18 @@
 
 #include "net_common.h"
 #include "net_concurrent_queue.h"
+#include "net_spsc_queue.h"
+#include "net_mpsc_queue.h"
+#include "net_mailbox.h"
+#include "net_histogram.h"
+#include "net_link.h"
+#include "net_metrics.h"
+#include "net_metrics_http.h"
+#include "net_entropy.h"
+#include "net_realtime.h"
 #include "net_message.h"
 #include "net_client.h"
 #include "net_server.h"
 #include "net_connection.h"
+#include "net_udp.h"
+#include "net_shm.h"
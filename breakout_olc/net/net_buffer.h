@@ -0,0 +1,179 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_endian.h"
+
+namespace net
+{
+    // Byte buffer keeping up to InlineCapacity bytes inside the object and only
+    // going to the heap beyond that. Growing is explicit (reserve) or geometric
+    // (resize/append), and shrinking never releases memory, so building and
+    // consuming the small payloads of this protocol never allocate.
+    template <size_t InlineCapacity>
+    class small_buffer
+    {
+    public:
+        small_buffer() = default;
+
+        small_buffer(const small_buffer &other)
+        {
+            this->assign(other.begin(), other.end());
+        }
+
+        small_buffer(small_buffer &&other) noexcept
+        {
+            this->moveFrom(other);
+        }
+
+        small_buffer &operator=(const small_buffer &other)
+        {
+            if (this != &other)
+                this->assign(other.begin(), other.end());
+            return *this;
+        }
+
+        small_buffer &operator=(small_buffer &&other) noexcept
+        {
+            if (this != &other)
+            {
+                this->heap.reset();
+                this->capacityBytes = InlineCapacity;
+                this->moveFrom(other);
+            }
+            return *this;
+        }
+
+    public:
+        uint8_t *data() { return this->heap ? this->heap.get() : this->inlineStorage; }
+        const uint8_t *data() const { return this->heap ? this->heap.get() : this->inlineStorage; }
+
+        uint8_t *begin() { return this->data(); }
+        uint8_t *end() { return this->data() + this->length; }
+        const uint8_t *begin() const { return this->data(); }
+        const uint8_t *end() const { return this->data() + this->length; }
+
+        size_t size() const { return this->length; }
+        bool empty() const { return this->length == 0; }
+        size_t capacity() const { return this->capacityBytes; }
+        bool isInline() const { return !this->heap; }
+
+        void reserve(size_t size)
+        {
+            if (size <= this->capacityBytes)
+                return;
+            std::unique_ptr<uint8_t[]> grown(new uint8_t[size]);
+            std::memcpy(grown.get(), this->data(), this->length);
+            this->heap = std::move(grown);
+            this->capacityBytes = size;
+        }
+
+        // new bytes are zeroed
+        void resize(size_t size)
+        {
+            if (size > this->capacityBytes)
+                this->reserve(std::max(size, 2 * this->capacityBytes));
+            if (size > this->length)
+                std::memset(this->data() + this->length, 0, size - this->length);
+            this->length = size;
+        }
+
+        // drops the bytes beyond size, keeping the storage
+        void truncate(size_t size) { this->length = std::min(this->length, size); }
+
+        void clear() { this->length = 0; }
+
+        template <typename TIterator>
+        void assign(TIterator first, TIterator last)
+        {
+            const size_t size = size_t(std::distance(first, last));
+            this->length = 0;
+            this->reserve(size);
+            std::copy(first, last, this->data());
+            this->length = size;
+        }
+
+        void append(const void *bytes, size_t size)
+        {
+            if (this->length + size > this->capacityBytes)
+                this->reserve(std::max(this->length + size, 2 * this->capacityBytes));
+            std::memcpy(this->data() + this->length, bytes, size);
+            this->length += size;
+        }
+
+    private:
+        uint8_t inlineStorage[InlineCapacity];
+        std::unique_ptr<uint8_t[]> heap;
+        size_t length = 0;
+        size_t capacityBytes = InlineCapacity;
+
+        void moveFrom(small_buffer &other)
+        {
+            if (other.heap)
+            {
+                this->heap = std::move(other.heap);
+                this->capacityBytes = other.capacityBytes;
+            }
+            else
+            {
+                std::memcpy(this->inlineStorage, other.inlineStorage, other.length);
+            }
+            this->length = other.length;
+            other.length = 0;
+            other.capacityBytes = InlineCapacity;
+        }
+    };
+
+    // Non-owning forward cursor over a payload (a msg body or a receive buffer).
+    // Nothing is copied but the fields read; the bytes must outlive the reader.
+    class message_reader
+    {
+    public:
+        message_reader(const uint8_t *data, size_t size) : cursor(data), last(data + size)
+        {
+        }
+
+        template <size_t InlineCapacity>
+        explicit message_reader(const small_buffer<InlineCapacity> &buffer) : message_reader(buffer.data(), buffer.size())
+        {
+        }
+
+    public:
+        size_t remaining() const { return size_t(this->last - this->cursor); }
+        const uint8_t *peek() const { return this->cursor; }
+
+        // copies the next sizeof(TData) bytes as they are; false, and nothing read, if too short
+        template <typename TData>
+        bool read(TData &data)
+        {
+            static_assert(std::is_trivially_copyable<TData>::value, "Data is too complex for message.");
+            if (this->remaining() < sizeof(TData))
+                return false;
+            std::memcpy(&data, this->cursor, sizeof(TData));
+            this->cursor += sizeof(TData);
+            return true;
+        }
+
+        // decodes the next value from its wire representation (see wire_codec)
+        template <typename TData>
+        bool decode(TData &data)
+        {
+            if (this->remaining() < wire_codec<TData>::size)
+                return false;
+            data = wire_codec<TData>::decode(this->cursor);
+            this->cursor += wire_codec<TData>::size;
+            return true;
+        }
+
+        bool skip(size_t size)
+        {
+            if (this->remaining() < size)
+                return false;
+            this->cursor += size;
+            return true;
+        }
+
+    private:
+        const uint8_t *cursor;
+        const uint8_t *last;
+    };
+} // namespace net
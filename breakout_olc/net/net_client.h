@@ -1,7 +1,6 @@
 #pragma once
 
 #include "net_common.h"
-#include "net_concurrent_queue.h"
 #include "net_message.h"
 #include "net_connection.h"
 
@@ -15,7 +14,10 @@ namespace net
         virtual ~client_interface() { disconnect(); }
 
     public:
-        bool connect(const std::string &host, const uint16_t port)
+        // starts connecting in the background, isConnected tells when it is done;
+        // false if the host cannot be resolved. A framed client connecting again after
+        // a disconnect asks for its earlier session back (see forgetSession)
+        bool connect(const std::string &host, const uint16_t port, protocol_version protocol = protocol_version::framed)
         {
             try
             {
@@ -24,34 +26,40 @@ namespace net
                 asio::ip::tcp::resolver::results_type endpoints = resolver.resolve(host, std::to_string(port));
 
                 // create connection
-                this->connectionToServer = std::make_unique<connection<T>>(
+                this->connectionToServer = std::make_shared<connection<T>>(
                     connection<T>::owner::client,
                     this->context,
                     asio::ip::tcp::socket(this->context),
                     this->msgsIn);
 
-                this->connectionToServer->connectToServer(endpoints);
+                this->connectionToServer->connectToServer(endpoints, protocol, this->resumeToken);
                 this->contextThread = std::thread([this]() { this->context.run(); });
             }
             catch (const std::exception &e)
             {
                 std::cerr << "[CLIENT] Exception: " << e.what() << '\n';
-                throw e;
+                return false;
             }
 
-            return false;
+            return true;
         }
 
         void disconnect()
         {
-            if (isConnected())
+            if (this->connectionToServer && this->connectionToServer->getToken() != 0)
+                this->resumeToken = this->connectionToServer->getToken();
+            if (this->connectionToServer)
                 this->connectionToServer->disconnect();
 
-            this->context.stop();
+            // the context runs out of work once the aborted handlers ran; running it here too
+            // covers a thread that had returned already, so none is left for the next connect
             if (this->contextThread.joinable())
                 this->contextThread.join();
+            this->context.restart();
+            this->context.run();
 
-            this->connectionToServer.release();
+            this->connectionToServer.reset();
+            this->context.restart();
         }
 
         bool isConnected()
@@ -61,21 +69,31 @@ namespace net
             return false;
         }
 
+        // given by the server's ServerAccept (framed protocol only), 0 until then
+        uint32_t getId() const
+        {
+            return this->connectionToServer ? this->connectionToServer->getId() : 0;
+        }
+
+        // the next connect starts a new session rather than resuming the last one
+        void forgetSession() { this->resumeToken = 0; }
+
         void send(const message<T> &msg)
         {
             if (this->isConnected())
                 this->connectionToServer->send(msg);
         }
 
-        concurrent_queue<double> &getIncomingMessages() { return this->msgsIn; }
+        message_queue<T> &getIncomingMessages() { return this->msgsIn; }
 
     protected:
         asio::io_context context;                          // handles data transfer
         std::thread contextThread;                         // thread for the asio context
         asio::ip::tcp::socket socket;                      // socket to server
-        std::unique_ptr<connection<T>> connectionToServer; // client instance of connection to server
+        std::shared_ptr<connection<T>> connectionToServer; // client instance of connection to server, held by its handlers too
 
     private:
-        concurrent_queue<double> msgsIn; // incoming server msgs
+        message_queue<T> msgsIn;  // incoming server msgs
+        uint64_t resumeToken = 0; // of the last connection, sent by the next one
     };
 } // namespace net
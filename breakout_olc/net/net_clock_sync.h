@@ -0,0 +1,133 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_mailbox.h"
+
+namespace net
+{
+    // latest estimate of a remote steady clock against ours (ns)
+    struct clock_estimate
+    {
+        int64_t offset = 0;     // remote - local, at reference
+        double drift = 0;       // d(offset)/d(local time), i.e. relative rate error of the remote clock
+        uint64_t reference = 0; // local time the offset was measured at, 0 until the first sample
+        uint64_t delay = 0;     // round trip of the sample the offset comes from, bounds its error (+/- delay/2)
+    };
+
+    // NTP-style estimator of a remote clock, fed with the four timestamps of a
+    // ping exchange: t1 sent and t4 back on our clock, t2 received and t3 sent
+    // on the remote's. Queueing only ever lengthens a round trip, so of the
+    // last few samples the one with the shortest round trip gives the offset
+    // (min-RTT filter); the drift is the slope of those offsets over a span of
+    // at least minDriftSpan, restarted every resyncPeriod so that it follows
+    // temperature changes. A jump far beyond what the drift predicts (the
+    // remote rebooted) starts the estimate over.
+    //
+    // One thread adds samples (the connection's strand), any thread converts.
+    class clock_sync
+    {
+    public:
+        static constexpr size_t windowSize = 8;
+        static constexpr uint64_t minDriftSpan = 10000000000ull;  // 10 s
+        static constexpr uint64_t resyncPeriod = 300000000000ull; // 5 min
+        static constexpr int64_t stepThreshold = 20000000;        // 20 ms
+
+        clock_sync() = default;
+        clock_sync(const clock_sync &) = delete;
+
+    public:
+        // strand only
+        void addSample(uint64_t t1, uint64_t t2, uint64_t t3, uint64_t t4)
+        {
+            if (t4 < t1 || t3 < t2 || t4 - t1 < t3 - t2)
+                return; // not a round trip, or a remote that took longer than the whole exchange
+
+            sample &latest = this->window[this->samples++ % windowSize];
+            latest.delay = (t4 - t1) - (t3 - t2);
+            latest.offset = ((int64_t(t2) - int64_t(t1)) + (int64_t(t3) - int64_t(t4))) / 2;
+            latest.at = t1 + (t4 - t1) / 2;
+
+            const sample *best = &this->window[0];
+            for (size_t i = 1; i < std::min<size_t>(this->samples, windowSize); ++i)
+                if (this->window[i].delay < best->delay)
+                    best = &this->window[i];
+
+            clock_estimate estimate = this->current.load();
+            if (estimate.reference != 0)
+            {
+                const int64_t predicted = predict(estimate, best->at);
+                if (std::abs(best->offset - predicted) > stepThreshold + int64_t(best->delay))
+                {
+                    // the remote clock stepped: keep only the sample that saw it
+                    this->window[0] = latest;
+                    this->samples = 1;
+                    best = &this->window[0];
+                    estimate = clock_estimate();
+                    this->anchor = sample();
+                }
+            }
+
+            if (this->anchor.at == 0 || best->at - this->anchor.at > resyncPeriod)
+            {
+                if (this->anchor.at != 0)
+                    estimate.drift = this->slope(*best);
+                this->anchor = *best;
+            }
+            else if (best->at - this->anchor.at >= minDriftSpan)
+            {
+                estimate.drift = this->slope(*best);
+            }
+
+            estimate.offset = best->offset;
+            estimate.reference = best->at;
+            estimate.delay = best->delay;
+            this->current.store(estimate);
+        }
+
+    public:
+        bool isSynced() const { return this->current.version() > 0; }
+        clock_estimate estimate() const { return this->current.load(); }
+
+        // a remote timestamp in our steady clock domain; remote itself until synced
+        uint64_t toLocal(uint64_t remote) const
+        {
+            const clock_estimate estimate = this->current.load();
+            if (estimate.reference == 0)
+                return remote;
+            const uint64_t approx = uint64_t(int64_t(remote) - estimate.offset);
+            return uint64_t(int64_t(remote) - predict(estimate, approx));
+        }
+
+        // one of our timestamps in the remote's clock domain
+        uint64_t toRemote(uint64_t local) const
+        {
+            const clock_estimate estimate = this->current.load();
+            if (estimate.reference == 0)
+                return local;
+            return uint64_t(int64_t(local) + predict(estimate, local));
+        }
+
+    private:
+        struct sample
+        {
+            uint64_t delay = 0;
+            int64_t offset = 0;
+            uint64_t at = 0; // local midpoint of the exchange
+        };
+
+        sample window[windowSize];
+        size_t samples = 0;
+        sample anchor; // start of the span the drift is measured over
+        mailbox<clock_estimate> current;
+
+        static int64_t predict(const clock_estimate &estimate, uint64_t local)
+        {
+            return estimate.offset + int64_t(estimate.drift * double(int64_t(local - estimate.reference)));
+        }
+
+        double slope(const sample &to) const
+        {
+            return double(to.offset - this->anchor.offset) / double(to.at - this->anchor.at);
+        }
+    };
+} // namespace net
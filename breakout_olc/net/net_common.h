@@ -6,12 +6,21 @@
 #include <queue>
 #include <deque>
 #include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <condition_variable>
 #include <algorithm>
+#include <cassert>
 #include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <chrono>
 #include <thread>
 #include <memory>
+#include <functional>
+#include <random>
 
-// #define QUEUE_MSGS_IMPLEMENTATION
+// #define LOCKED_QUEUE_IMPLEMENTATION
 #define ASIO_STANDALONE
 
 #include <asio.hpp>
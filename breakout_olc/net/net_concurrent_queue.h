@@ -31,14 +31,30 @@ namespace net
             const std::lock_guard<std::mutex> lock(this->mtxQueue);
             T item = std::move(this->dq.front());
             this->dq.pop_front();
+            this->items.store(this->dq.size(), std::memory_order_relaxed);
             return item;
         }
 
+        // returns false if the queue is empty, without locking then
+        bool try_pop(T &item)
+        {
+            if (this->items.load(std::memory_order_acquire) == 0)
+                return false;
+            const std::lock_guard<std::mutex> lock(this->mtxQueue);
+            if (this->dq.empty())
+                return false;
+            item = std::move(this->dq.front());
+            this->dq.pop_front();
+            this->items.store(this->dq.size(), std::memory_order_relaxed);
+            return true;
+        }
+
         T pop_back()
         {
             const std::lock_guard<std::mutex> lock(this->mtxQueue);
             T item = std::move(this->dq.back());
             this->dq.pop_back();
+            this->items.store(this->dq.size(), std::memory_order_relaxed);
             return item;
         }
 
@@ -46,6 +62,7 @@ namespace net
         {
             const std::lock_guard<std::mutex> lock(this->mtxQueue);
             this->dq.push_back(std::move(item));
+            this->items.store(this->dq.size(), std::memory_order_release);
 
             const std::unique_lock<std::mutex> ul(this->mtxBlock);
             this->cv.notify_one();
@@ -55,6 +72,7 @@ namespace net
         {
             const std::lock_guard<std::mutex> lock(this->mtxQueue);
             this->dq.push_front(std::move(item));
+            this->items.store(this->dq.size(), std::memory_order_release);
 
             const std::unique_lock<std::mutex> ul(this->mtxBlock);
             this->cv.notify_one();
@@ -72,10 +90,14 @@ namespace net
             return this->dq.size();
         }
 
+        // unbounded, never drops; for the interface of the bounded queues
+        uint64_t dropped() const { return 0; }
+
         void clear()
         {
             const std::lock_guard<std::mutex> lock(this->mtxQueue);
             this->dq.clear();
+            this->items.store(0, std::memory_order_relaxed);
         }
 
         void wait()
@@ -90,6 +112,7 @@ namespace net
     protected:
         std::mutex mtxQueue;
         std::deque<T> dq;
+        std::atomic<size_t> items{0}; // dq.size(), for try_pop to skip the lock when empty
 
         std::condition_variable cv;
         std::mutex mtxBlock;
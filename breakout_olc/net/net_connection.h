@@ -2,10 +2,53 @@
 
 #include "net_common.h"
 #include "net_concurrent_queue.h"
+#include "net_spsc_queue.h"
+#include "net_mpsc_queue.h"
 #include "net_message.h"
+#include "net_handler_memory.h"
+#include "net_link.h"
+#include "net_clock_sync.h"
+#include "net_metrics.h"
+#include "net_entropy.h"
 
 namespace net
 {
+    // queue of msgs delivered by the asio threads to the thread calling server_interface::update;
+    // the spsc variant is only valid with a single asio thread
+#if defined(LOCKED_QUEUE_IMPLEMENTATION)
+    template <typename T>
+    using message_queue = concurrent_queue<owned_message<T>>;
+#elif defined(SPSC_QUEUE_IMPLEMENTATION)
+    template <typename T>
+    using message_queue = spsc_queue<owned_message<T>>;
+#else
+    template <typename T>
+    using message_queue = mpsc_queue<owned_message<T>>;
+#endif
+
+    // Control frames and lifecycle events (resume Hello, Closed) of every connection, drained
+    // by the server thread before each message of msgsIn so that they overtake
+    // any command backlog. Unbounded, as none of them may be lost when msgsIn
+    // is full; they are rare, so the lock is only taken when one is queued.
+    template <typename T>
+    using control_queue = concurrent_queue<owned_message<T>>;
+
+    enum class receive_mode
+    {
+        exact, // one async_read per frame
+        bulk,  // async_read_some into a reusable buffer, decoding every complete frame at once
+#if defined(ASIO_HAS_CO_AWAIT)
+        coroutine // as bulk, with the reads and the writes as two coroutines on the strand (C++20)
+#endif
+    };
+
+    enum class protocol_version
+    {
+        unknown, // server side, until the first bytes tell legacy from framed
+        legacy,  // naked big-endian T values
+        framed   // protocol::magic + Hello, then message_header framed messages
+    };
+
     template <typename T>
     class connection : public std::enable_shared_from_this<connection<T>>
     {
@@ -19,47 +62,154 @@ namespace net
             client
         };
 
-        connection(owner owner, asio::io_context &newContext, asio::ip::tcp::socket newSocket, concurrent_queue<owned_message<T>> &queue)
-            : context(newContext), socket(std::move(newSocket)), msgsIn(queue)
+        connection(owner owner, asio::io_context &newContext, asio::ip::tcp::socket newSocket, message_queue<T> &queue,
+                   receive_mode mode = receive_mode::bulk)
+            : context(newContext), strand(asio::make_strand(newContext)), socket(std::move(newSocket)),
+              heartbeatTimer(newContext),
+#if defined(ASIO_HAS_CO_AWAIT)
+              writeWake(newContext),
+#endif
+              msgsIn(queue)
         {
             this->ownerType = owner;
+            this->receiveMode = mode;
+            if (owner == owner::server)
+                this->token = drawToken();
+            this->connected = this->socket.is_open();
+            if (this->connected)
+            {
+                asio::error_code ec;
+                this->remote = this->socket.remote_endpoint(ec).address();
+                this->socket.set_option(asio::ip::tcp::no_delay(true), ec); // frames are tiny and latency bound
+            }
         }
 
         virtual ~connection() {}
 
-        void connectToThisClient(uint32_t id)
+        // the server assigns the id and registers the connection before calling
+        // connectToThisClient, so that none of its msgs can be dispatched before that
+        void assignId(uint32_t id)
+        {
+            if (this->ownerType == owner::server)
+                this->id = id;
+        }
+
+        void connectToThisClient()
         {
             if (this->ownerType != owner::server)
                 return;
-            if (this->socket.is_open())
-            {
-                this->id = id;
-                this->readHeaderAsync();
-            }
+            if (this->isConnected())
+                asio::dispatch(this->strand, [this, self = this->keepAlive()]() { this->readAsync(); });
         }
 
-        void connectToServer(const asio::ip::tcp::resolver::results_type &endpoints)
+        // legacy clients send naked T values, framed ones negotiate with a Hello first,
+        // which carries resumeToken (if not 0) to ask for the session of an earlier connection
+        void connectToServer(const asio::ip::tcp::resolver::results_type &endpoints,
+                             protocol_version protocol = protocol_version::framed, uint64_t resumeToken = 0)
         {
             if (this->ownerType != owner::client)
                 return;
 
+            this->protocol = protocol;
             asio::async_connect(
                 this->socket,
                 endpoints,
-                [this](std::error_code ec, asio::ip::tcp::endpoint ep) {
-                    if (!ec)
-                        this->readHeaderAsync();
-                });
+                asio::bind_executor(this->strand, [this, self = this->keepAlive(), resumeToken](std::error_code ec, asio::ip::tcp::endpoint ep) {
+                    if (ec)
+                    {
+                        std::cerr << "[CLIENT] Connection failed: " << ec.message() << "\n";
+                        return;
+                    }
+
+                    asio::error_code ignored;
+                    this->socket.set_option(asio::ip::tcp::no_delay(true), ignored);
+                    this->connected = true;
+                    this->writable = true;
+                    if (this->protocol == protocol_version::framed)
+                    {
+                        message<T> hello;
+                        hello.header.id = msgType::Hello;
+                        hello.body.resize(resumeToken != 0 ? 12 : 4);
+                        wire::putU32(hello.body.data(), protocol::version);
+                        if (resumeToken != 0)
+                            wire::putU64(hello.body.data() + 4, resumeToken);
+                        hello.header.size = hello.size();
+                        this->msgsOut.push_front(std::move(hello));
+                    }
+                    if (!this->msgsOut.empty())
+                        this->writeAsync();
+                    this->readAsync();
+                }));
+        }
+
+        // server side, before connectToThisClient: Control frames, resume Hellos and Closed go to controls rather than msgsIn
+        void setControlQueue(control_queue<T> *controls) { this->controlsIn = controls; }
+
+        // server side, before connectToThisClient: a legacy remote sending value means the
+        // control code instead, for remotes that cannot send Control frames
+        void setLegacySentinel(const T &value, uint32_t code)
+        {
+            this->hasLegacySentinel = true;
+            this->legacySentinel = value;
+            this->legacySentinelCode = code;
+        }
+
+        // server side: pings the remote and watches for silence (see heartbeat_config)
+        void startHeartbeat(const heartbeat_config &config)
+        {
+            if (this->ownerType != owner::server || config.interval.count() <= 0)
+                return;
+            asio::dispatch(this->strand, [this, self = this->keepAlive(), config]() {
+                this->heartbeat = config;
+                this->link.start(config, protocol::timestampNow());
+                this->scheduleHeartbeat();
+            });
         }
 
+        // also cancels a connect still pending; every pending handler then completes, aborted
         void disconnect()
         {
-            if (this->isConnected())
-                asio::post(this->context, [this]() { this->socket.close(); });
+            asio::post(this->strand, [this, self = this->keepAlive()]() { this->close(); });
+        }
+
+        // queues msg for the remote; safe to call from any thread. A framed remote
+        // gets nothing of a msg over protocol::maxPayloadSize: its header could
+        // not encode the size, and the remote would drop the link for it.
+        // Telemetry is latest-wins: a telemetry msg replaces the one still queued,
+        // so a remote that stops reading holds back at most one
+        void send(const message<T> &msg)
+        {
+            asio::post(this->strand, [this, self = this->keepAlive(), msg]() mutable {
+                if (this->protocol == protocol_version::framed && msg.size() > protocol::maxPayloadSize)
+                {
+                    std::cerr << "[" << this->id << "] Not sent: " << msg.size() << " bytes payload.\n";
+                    return;
+                }
+                if (msg.header.channel == msgChannel::telemetry)
+                {
+                    auto queued = std::find_if(this->msgsOut.rbegin(), this->msgsOut.rend(), [](const message<T> &out) {
+                        return out.header.channel == msgChannel::telemetry;
+                    });
+                    if (queued != this->msgsOut.rend())
+                    {
+                        *queued = std::move(msg);
+                        this->metrics.telemetryOverwritten.add();
+                        return;
+                    }
+                }
+                this->msgsOut.push_back(std::move(msg));
+                if (this->writable && !this->writeInProgress)
+                    this->writeAsync();
+            });
         }
 
-        bool isConnected() const { return this->socket.is_open(); }
+        bool isConnected() const { return this->connected; }
         uint32_t getId() const { return this->id; }
+        uint64_t getToken() const { return this->token; } // resume token, given by the server (framed protocol only)
+        const asio::ip::address &remoteAddress() const { return this->remote; } // server side only
+        const link_stats &linkStats() const { return this->link; }              // server side only
+        const clock_sync &remoteClock() const { return this->clock; }          // server side only, fed by the heartbeat
+        protocol_version getProtocol() const { return this->protocol; }
 
         friend std::ostream &operator<<(std::ostream &os, const connection<T> &conn)
         {
@@ -68,43 +218,578 @@ namespace net
         }
 
     protected:
-        asio::io_context &context;                  // context of whole asio
-        asio::ip::tcp::socket socket;               // unique socket to a remote
-        concurrent_queue<T> msgsOut;                // queue of msgs to be sent to remote
-        concurrent_queue<owned_message<T>> &msgsIn; // queue of msgs sent by remote
-
-        union
-        {
-            T val;
-            char bytes[sizeof(T)];
-        } tmpMsg;
+        asio::io_context &context;                                // context of whole asio
+        asio::strand<asio::io_context::executor_type> strand;     // serializes every handler of this connection
+        asio::ip::tcp::socket socket;                             // unique socket to a remote
+        asio::steady_timer heartbeatTimer;                        // next ServerPing and silence check (strand only)
+#if defined(ASIO_HAS_CO_AWAIT)
+        asio::steady_timer writeWake; // never expires, cancelled to wake the write coroutine (strand only)
+#endif
+        std::atomic<bool> connected{false};                       // mirrors socket.is_open() for other threads
+        asio::ip::address remote;                                 // address of the accepted remote
+        std::deque<message<T>> msgsOut;                           // queue of msgs to be sent to remote (strand only)
+        message_queue<T> &msgsIn;                                 // queue of msgs sent by remote
+        control_queue<T> *controlsIn = nullptr;                   // queue of Control frames, resume Hellos and Closed, if separate
 
         owner ownerType = owner::server;
-        uint32_t id = 0;
+        std::atomic<uint32_t> id{0}; // set by the server, or by the ServerAccept on the strand of a client
+        std::atomic<uint64_t> token{0}; // drawn by the server side, learnt from the ServerAccept by the client
+        protocol_version protocol = protocol_version::unknown;
+
+        static constexpr size_t readBufferSize = 4096;
+        receive_mode receiveMode = receive_mode::bulk;
+        char readBuffer[readBufferSize]; // receive buffer, holds at most one partial frame between reads
+        size_t readBuffered = 0;         // bytes of a partial frame carried over to the next read
+        uint32_t legacySequence = 0;     // receive counter standing in for the sequence of legacy frames
+        T legacyValues[readBufferSize / wire_codec<T>::size]; // legacy values of one read, decoded in bulk
+        bool hasLegacySentinel = false; // legacy remotes only: a value that stands for a control
+        T legacySentinel{};
+        uint32_t legacySentinelCode = 0;
+        handler_memory readHandlerMemory; // reused by every read, so the receive path does not allocate
+
+        typedef std::array<uint8_t, protocol::headerSize> header_bytes;
+        std::vector<message<T>> msgsWriting;          // msgs owned by the write in flight
+        std::vector<header_bytes> headersWriting;     // their encoded headers (framed protocol only)
+        std::vector<asio::const_buffer> writeBuffers; // gather list over the two above
+        bool writable = false;                        // connected (client) or protocol detected (server)
+        bool writeInProgress = false;
+        bool closedQueued = false; // by close(), the first time
+        bool magicSent = false;
+        uint32_t sendSequence = 0;
+        handler_memory writeHandlerMemory;
+
+        heartbeat_config heartbeat; // strand only
+        uint32_t pingSequence = 0;
+        link_stats link;
+        clock_sync clock;
+        transport_metrics &metrics = transport_metrics::get();
 
     private:
+        // a bearer credential for the session, so drawn from the OS cryptographic
+        // generator (see entropy::fill); 0, no token, if it failed
+        static uint64_t drawToken()
+        {
+            uint64_t drawn = 0;
+            while (drawn == 0)
+            {
+                if (!entropy::fill(&drawn, sizeof(drawn)))
+                    return 0;
+            }
+            return drawn;
+        }
+
+        // handlers hold this while pending, so a server connection dropped by its owner
+        // lives until the last of them ran; client_interface shares its connection the same way
+        std::shared_ptr<connection<T>> keepAlive()
+        {
+            return this->weak_from_this().lock();
+        }
+
+        // strand only; whatever the reason, the server hears of it once, as a Closed
+        void close()
+        {
+            this->connected = false;
+            this->socket.close();
+            this->heartbeatTimer.cancel();
+#if defined(ASIO_HAS_CO_AWAIT)
+            this->writeWake.cancel();
+#endif
+            if (!this->closedQueued)
+            {
+                this->closedQueued = true;
+                this->queueClosed();
+            }
+        }
+
+        void scheduleHeartbeat()
+        {
+            this->heartbeatTimer.expires_after(this->heartbeat.interval);
+            this->heartbeatTimer.async_wait(asio::bind_executor(this->strand, [this, self = this->keepAlive()](std::error_code ec) {
+                if (!ec && this->isConnected())
+                    this->onHeartbeat();
+            }));
+        }
+
+        void onHeartbeat()
+        {
+            const uint64_t now = protocol::timestampNow();
+            const uint64_t timeout = uint64_t(std::chrono::nanoseconds(this->heartbeat.timeout).count());
+            if (timeout > 0 && this->link.silence(now) > timeout)
+            {
+                std::cerr << "[" << this->id << "] Link timed out: nothing received for " << this->link.silence(now) / 1000000 << " ms.\n";
+                this->metrics.linkTimeouts.add();
+                this->close();
+                return;
+            }
+
+            // legacy remotes would take the ping for commands
+            if (this->protocol == protocol_version::framed)
+            {
+                message<T> ping;
+                ping.header.id = msgType::ServerPing;
+                ping.header.channel = msgChannel::system;
+                ping.body.resize(12);
+                wire::putU32(ping.body.data(), ++this->pingSequence);
+                wire::putU64(ping.body.data() + 4, now);
+                ping.header.size = ping.size();
+                this->msgsOut.push_back(std::move(ping));
+                if (!this->writeInProgress)
+                    this->writeAsync();
+                this->link.pingSent();
+            }
+            this->scheduleHeartbeat();
+        }
+
+        // lets the server thread clean up as for any other disconnection
+        void queueClosed()
+        {
+            if (this->ownerType != owner::server)
+                return;
+            owned_message<T> owned_msg;
+            owned_msg.header.id = msgType::Closed;
+            owned_msg.remoteId = this->id;
+            this->pushPriority(owned_msg);
+        }
+
+        void readAsync()
+        {
+#if defined(ASIO_HAS_CO_AWAIT)
+            if (this->receiveMode == receive_mode::coroutine)
+            {
+                asio::co_spawn(this->strand, this->readLoop(this->keepAlive()), asio::detached);
+                asio::co_spawn(this->strand, this->writeLoop(this->keepAlive()), asio::detached);
+                return;
+            }
+#endif
+            if (this->receiveMode == receive_mode::bulk)
+                this->readBulkAsync();
+            else
+                this->readHeaderAsync();
+        }
+
+        // reads exactly the bytes that complete the next header or frame
         void readHeaderAsync()
         {
             if (!this->isConnected())
                 return;
 
-            auto on_complete = [this](std::error_code ec, std::size_t length) {
-                this->addToIncomingMessageQueue();
+            auto on_complete = [this, self = this->keepAlive()](std::error_code ec, std::size_t length) {
+                if (ec)
+                {
+                    this->onReadError(ec);
+                    return;
+                }
+                if (this->consumeReadBuffer(length))
+                    this->readHeaderAsync();
             };
-            asio::async_read(this->socket, asio::buffer(this->tmpMsg.bytes), on_complete);
+            asio::async_read(
+                this->socket,
+                asio::buffer(this->readBuffer + this->readBuffered, this->bytesToNextFrame()),
+                asio::bind_executor(this->strand, makeCustomAllocHandler(this->readHandlerMemory, on_complete)));
+        }
+
+        void readBulkAsync()
+        {
+            if (!this->isConnected())
+                return;
+
+            auto on_complete = [this, self = this->keepAlive()](std::error_code ec, std::size_t length) {
+                if (ec)
+                {
+                    this->onReadError(ec);
+                    return;
+                }
+
+                if (this->consumeReadBuffer(length))
+                    this->readBulkAsync();
+            };
+            this->socket.async_read_some(
+                asio::buffer(this->readBuffer + this->readBuffered, readBufferSize - this->readBuffered),
+                asio::bind_executor(this->strand, makeCustomAllocHandler(this->readHandlerMemory, on_complete)));
+        }
+
+#if defined(ASIO_HAS_CO_AWAIT)
+        // Same reads as readBulkAsync, as one loop: each read decodes every
+        // complete frame at once, errors end the loop through onReadError, and
+        // close() cancels the pending read. The coroutine frame holds self and
+        // is allocated once for the whole connection.
+        asio::awaitable<void> readLoop(std::shared_ptr<connection<T>> self)
+        {
+            asio::error_code ec;
+            while (this->isConnected())
+            {
+                const size_t length = co_await this->socket.async_read_some(
+                    asio::buffer(this->readBuffer + this->readBuffered, readBufferSize - this->readBuffered),
+                    asio::redirect_error(asio::use_awaitable, ec));
+                if (ec)
+                {
+                    this->onReadError(ec);
+                    co_return;
+                }
+                if (!this->consumeReadBuffer(length))
+                    co_return;
+            }
+        }
+
+        // Sends everything queued as one gather write, then sleeps on writeWake
+        // until writeAsync wakes it for more; close() wakes it to return.
+        asio::awaitable<void> writeLoop(std::shared_ptr<connection<T>> self)
+        {
+            asio::error_code ec;
+            while (this->isConnected())
+            {
+                if (!this->writable || this->msgsOut.empty())
+                {
+                    this->writeWake.expires_at(asio::steady_timer::time_point::max());
+                    co_await this->writeWake.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                    continue;
+                }
+
+                this->prepareWrite();
+                this->writeInProgress = true;
+                const size_t length = co_await asio::async_write(this->socket, this->writeBuffers,
+                                                                 asio::redirect_error(asio::use_awaitable, ec));
+                this->writeInProgress = false;
+                if (ec)
+                {
+                    if (ec != asio::error::operation_aborted)
+                        std::cerr << "[" << this->id << "] Write failed: " << ec.message() << "\n";
+                    this->msgsOut.clear();
+                    this->close();
+                    co_return;
+                }
+                this->metrics.bytesSent.add(length);
+            }
+            this->msgsOut.clear();
+        }
+#endif
+
+        // decodes every complete frame in the buffer, then moves the trailing partial one
+        // to the front; returns false if the stream is malformed and the socket was closed
+        bool consumeReadBuffer(size_t length)
+        {
+            const size_t available = this->readBuffered + length;
+            size_t consumed = 0;
+            this->metrics.bytesReceived.add(length);
+            if (this->link.isEnabled())
+                this->link.heard(protocol::timestampNow());
+            while (true)
+            {
+                const uint8_t *data = reinterpret_cast<const uint8_t *>(this->readBuffer) + consumed;
+                const size_t left = available - consumed;
+
+                if (this->protocol == protocol_version::unknown)
+                {
+                    if (left < sizeof(protocol::magic))
+                        break;
+                    if (std::memcmp(data, protocol::magic, sizeof(protocol::magic)) == 0)
+                    {
+                        this->protocol = protocol_version::framed;
+                        consumed += sizeof(protocol::magic);
+                    }
+                    else
+                    {
+                        this->protocol = protocol_version::legacy;
+                    }
+
+                    // msgs queued so far can now be encoded for the remote
+                    this->writable = true;
+                    if (!this->msgsOut.empty() && !this->writeInProgress)
+                        this->writeAsync();
+                }
+                else if (this->protocol == protocol_version::legacy)
+                {
+                    // the legacy stream is a plain array of values, decoded in one go
+                    const size_t count = left / wire_codec<T>::size;
+                    if (count == 0)
+                        break;
+                    decodeArray(this->legacyValues, data, count);
+                    this->metrics.commandsReceived.add(count);
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        if (this->hasLegacySentinel && this->legacyValues[i] == this->legacySentinel)
+                        {
+                            control_message control;
+                            control.code = this->legacySentinelCode;
+                            this->queueControl(control);
+                            continue;
+                        }
+                        message_header<T> header;
+                        header.id = msgType::Command;
+                        header.channel = msgChannel::command;
+                        header.sequence = ++this->legacySequence;
+                        header.size = wire_codec<T>::size;
+                        this->addToIncomingMessageQueue(this->legacyValues[i], header);
+                    }
+                    consumed += count * wire_codec<T>::size;
+                }
+                else
+                {
+                    if (left < protocol::headerSize)
+                        break;
+                    const message_header<T> header = message_header<T>::decode(data);
+                    if (header.size > protocol::maxPayloadSize)
+                    {
+                        std::cerr << "[" << this->id << "] Protocol error: " << header.size << " bytes payload.\n";
+                        this->metrics.protocolErrors.add();
+                        this->close();
+                        return false;
+                    }
+                    if (left < protocol::headerSize + header.size)
+                        break;
+                    this->onFrame(header, data + protocol::headerSize);
+                    consumed += protocol::headerSize + header.size;
+                }
+            }
+
+            this->readBuffered = available - consumed;
+            if (this->readBuffered > 0 && consumed > 0)
+                std::memmove(this->readBuffer, this->readBuffer + consumed, this->readBuffered);
+            return true;
+        }
+
+        size_t bytesToNextFrame() const
+        {
+            size_t frameSize;
+            if (this->protocol == protocol_version::unknown)
+                frameSize = sizeof(protocol::magic);
+            else if (this->protocol == protocol_version::legacy)
+                frameSize = wire_codec<T>::size;
+            else if (this->readBuffered < protocol::headerSize)
+                frameSize = protocol::headerSize;
+            else
+                frameSize = protocol::headerSize + message_header<T>::decode(reinterpret_cast<const uint8_t *>(this->readBuffer)).size;
+            return frameSize - this->readBuffered;
+        }
+
+        void onFrame(const message_header<T> &header, const uint8_t *payload)
+        {
+            if (header.id == msgType::Command)
+                this->metrics.commandsReceived.add();
+            else
+                this->metrics.framesReceived.add();
+
+            switch (header.id)
+            {
+            case msgType::Hello:
+                if (this->ownerType != owner::server)
+                    break;
+                this->sendAccept();
+                if (header.size >= 12)
+                {
+                    // a resume request, for the server to hand the earlier session over; on the
+                    // priority path, so it is never dropped and comes before the client's controls
+                    owned_message<T> owned_msg;
+                    owned_msg.header = header;
+                    owned_msg.body.assign(payload, payload + header.size);
+                    owned_msg.received = protocol::timestampNow();
+                    owned_msg.remoteId = this->id;
+                    this->pushPriority(owned_msg);
+                }
+                break;
+
+            case msgType::ServerAccept:
+                if (this->ownerType == owner::client && header.size >= 8)
+                    this->id = wire::getU32(payload + 4);
+                if (this->ownerType == owner::client && header.size >= 16)
+                    this->token = wire::getU64(payload + 8);
+                break;
+
+            case msgType::ServerPing:
+                if (this->ownerType == owner::client)
+                {
+                    // echoed with the time it arrived; the header timestamp will tell when it left
+                    message<T> pong;
+                    pong.header.id = msgType::ServerPing;
+                    pong.header.channel = msgChannel::system;
+                    pong.body.assign(payload, payload + std::min<size_t>(header.size, 12));
+                    pong.body.resize(20);
+                    wire::putU64(pong.body.data() + 12, protocol::timestampNow());
+                    pong.header.size = pong.size();
+                    this->msgsOut.push_back(std::move(pong));
+                    if (!this->writeInProgress)
+                        this->writeAsync();
+                }
+                else if (header.size >= 12)
+                {
+                    const uint64_t sent = wire::getU64(payload + 4);
+                    const uint64_t now = protocol::timestampNow();
+                    if (now > sent)
+                    {
+                        this->link.pongReceived(now - sent);
+                        this->metrics.rtt.observe(now - sent);
+                    }
+                    if (header.size >= 20)
+                        this->clock.addSample(sent, wire::getU64(payload + 12), header.timestamp, now);
+                }
+                break;
+
+            case msgType::Command:
+                if (header.size == wire_codec<T>::size)
+                    this->addToIncomingMessageQueue(wire_codec<T>::decode(payload), header);
+                break;
+
+            default:
+            {
+                owned_message<T> owned_msg;
+                owned_msg.header = header;
+                owned_msg.body.assign(payload, payload + header.size);
+                owned_msg.received = protocol::timestampNow();
+                owned_msg.remoteId = this->id;
+                if (header.id == msgType::Control)
+                    this->pushPriority(owned_msg);
+                else
+                    this->msgsIn.push_back(owned_msg); // dropped, and counted, if msgsIn is full
+                break;
+            }
+            }
+        }
+
+        // answers a Hello with the negotiated version and the id assigned to the client
+        void sendAccept()
+        {
+            message<T> accept;
+            accept.header.id = msgType::ServerAccept;
+            accept.body.resize(16);
+            wire::putU32(accept.body.data(), protocol::version);
+            wire::putU32(accept.body.data() + 4, this->id);
+            wire::putU64(accept.body.data() + 8, this->token);
+            accept.header.size = accept.size();
+            this->msgsOut.push_back(std::move(accept));
+            if (!this->writeInProgress)
+                this->writeAsync();
+        }
+
+        void onReadError(const std::error_code &ec)
+        {
+            if (ec != asio::error::operation_aborted) // else closed on purpose, and reported then
+                std::cerr << "[" << this->id << "] Read failed: " << ec.message() << "\n";
+            this->close();
+        }
+
+        // sends everything queued so far with a single gather write; at most one
+        // write is in flight, whatever is queued meanwhile goes in the next one
+        void writeAsync()
+        {
+#if defined(ASIO_HAS_CO_AWAIT)
+            if (this->receiveMode == receive_mode::coroutine)
+            {
+                this->writeWake.cancel(); // the write coroutine takes it from here
+                return;
+            }
+#endif
+            if (!this->isConnected())
+            {
+                this->msgsOut.clear();
+                return;
+            }
+
+            this->prepareWrite();
+            this->writeInProgress = true;
+            auto on_complete = [this, self = this->keepAlive()](std::error_code ec, std::size_t length) {
+                this->writeInProgress = false;
+                if (ec)
+                {
+                    std::cerr << "[" << this->id << "] Write failed: " << ec.message() << "\n";
+                    this->msgsOut.clear();
+                    this->close();
+                    return;
+                }
+                this->metrics.bytesSent.add(length);
+                if (!this->msgsOut.empty())
+                    this->writeAsync();
+            };
+            asio::async_write(this->socket, this->writeBuffers,
+                              asio::bind_executor(this->strand, makeCustomAllocHandler(this->writeHandlerMemory, on_complete)));
+        }
+
+        // moves msgsOut into msgsWriting and builds the gather list of the next write
+        void prepareWrite()
+        {
+            this->msgsWriting.clear();
+            this->writeBuffers.clear();
+            while (!this->msgsOut.empty())
+            {
+                this->msgsWriting.push_back(std::move(this->msgsOut.front()));
+                this->msgsOut.pop_front();
+            }
+
+            if (this->protocol == protocol_version::framed)
+            {
+                if (this->ownerType == owner::client && !this->magicSent)
+                {
+                    this->writeBuffers.push_back(asio::buffer(protocol::magic));
+                    this->magicSent = true;
+                }
+
+                const uint64_t now = protocol::timestampNow();
+                this->headersWriting.resize(this->msgsWriting.size());
+                for (size_t i = 0; i < this->msgsWriting.size(); ++i)
+                {
+                    message_header<T> &header = this->msgsWriting[i].header;
+                    header.size = uint32_t(this->msgsWriting[i].size());
+                    header.sequence = ++this->sendSequence;
+                    header.timestamp = now;
+                    header.encode(this->headersWriting[i].data());
+                    this->writeBuffers.push_back(asio::buffer(this->headersWriting[i]));
+                    if (header.size > 0)
+                        this->writeBuffers.push_back(asio::buffer(this->msgsWriting[i].body.data(), header.size));
+                }
+            }
+            else
+            {
+                // legacy remotes only understand the raw payload
+                for (const message<T> &msg : this->msgsWriting)
+                    if (msg.size() > 0)
+                        this->writeBuffers.push_back(asio::buffer(msg.body.data(), msg.size()));
+            }
+        }
+
+        void queueControl(const control_message &control)
+        {
+            owned_message<T> owned_msg;
+            owned_msg.header.id = msgType::Control;
+            owned_msg.header.channel = msgChannel::control;
+            owned_msg.header.size = control_message::size;
+            owned_msg.body.resize(control_message::size);
+            control.encode(owned_msg.body.data());
+            owned_msg.received = protocol::timestampNow();
+            owned_msg.remoteId = this->id;
+            this->pushPriority(owned_msg);
+        }
+
+        // on the priority queue, with an empty Control in msgsIn to wake a server
+        // thread waiting on it; the server skips those. A full msgsIn dropping
+        // the wake up is harmless, the server thread is not waiting then.
+        void pushPriority(const owned_message<T> &msg)
+        {
+            if (!this->controlsIn)
+            {
+                this->msgsIn.push_back(msg);
+                return;
+            }
+            this->controlsIn->push_back(msg);
+
+            owned_message<T> doorbell;
+            doorbell.header.id = msgType::Control;
+            doorbell.header.channel = msgChannel::control;
+            doorbell.remoteId = this->id;
+            this->msgsIn.push_back(doorbell);
         }
 
-        void addToIncomingMessageQueue()
+        // a full msgsIn drops the command (see msgsIn.dropped()): the server thread
+        // is that far behind, and the session only ever uses the latest command
+        void addToIncomingMessageQueue(const T &value, const message_header<T> &header)
         {
-            std::reverse(this->tmpMsg.bytes, this->tmpMsg.bytes + sizeof(T));
             owned_message<T> owned_msg;
-            owned_msg.msg = this->tmpMsg.val;
+            owned_msg.header = header;
+            owned_msg.msg = value;
+            owned_msg.received = protocol::timestampNow();
 
             if (this->ownerType == owner::server)
-                owned_msg.remote = this->shared_from_this();
+                owned_msg.remoteId = this->id;
 
             this->msgsIn.push_back(owned_msg);
-            this->readHeaderAsync();
         }
     };
 } // namespace net
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_connection.h"
+
+namespace net
+{
+    // Fixed-capacity table of the live connections of a server, indexed by id
+    // (an id lives in slot id % capacity). Inserts and erases lock, and so does
+    // find, which any thread may call. The thread that erases (the server's
+    // update thread) may also peek without locking: a slot only changes hands
+    // through that thread, and its id is published last, so resolving the id
+    // carried by a msg never takes a lock nor touches the heap.
+    template <typename T>
+    class connection_table
+    {
+    public:
+        explicit connection_table(size_t capacity = 1024) : capacity(capacity), slots(new slot[capacity])
+        {
+        }
+        connection_table(const connection_table<T> &) = delete;
+
+    public:
+        // registers client under the first unused id from next on and assigns it; 0 if full
+        uint32_t insert(const std::shared_ptr<connection<T>> &client, uint32_t &next)
+        {
+            const std::lock_guard<std::mutex> lock(this->mtx);
+            for (size_t tries = 0; tries < this->capacity; ++tries)
+            {
+                const uint32_t id = next++;
+                slot &cell = this->slots[id % this->capacity];
+                if (id == 0 || cell.id.load(std::memory_order_relaxed) != 0)
+                    continue;
+
+                client->assignId(id);
+                cell.client = client;
+                cell.id.store(id, std::memory_order_release);
+                this->count++;
+                return id;
+            }
+            return 0;
+        }
+
+        std::shared_ptr<connection<T>> find(uint32_t id)
+        {
+            const std::lock_guard<std::mutex> lock(this->mtx);
+            const std::shared_ptr<connection<T>> *client = this->peek(id);
+            return client ? *client : nullptr;
+        }
+
+        // erasing thread only
+        const std::shared_ptr<connection<T>> *peek(uint32_t id) const
+        {
+            const slot &cell = this->slots[id % this->capacity];
+            return id != 0 && cell.id.load(std::memory_order_acquire) == id ? &cell.client : nullptr;
+        }
+
+        bool erase(uint32_t id)
+        {
+            std::shared_ptr<connection<T>> removed; // released outside of the lock
+            {
+                const std::lock_guard<std::mutex> lock(this->mtx);
+                slot &cell = this->slots[id % this->capacity];
+                if (id == 0 || cell.id.load(std::memory_order_relaxed) != id)
+                    return false;
+
+                cell.id.store(0, std::memory_order_release);
+                removed = std::move(cell.client);
+                this->count--;
+            }
+            return true;
+        }
+
+        size_t size()
+        {
+            const std::lock_guard<std::mutex> lock(this->mtx);
+            return this->count;
+        }
+
+    private:
+        struct slot
+        {
+            std::atomic<uint32_t> id{0}; // 0 when free
+            std::shared_ptr<connection<T>> client;
+        };
+
+        std::mutex mtx;
+        size_t capacity;
+        std::unique_ptr<slot[]> slots;
+        size_t count = 0;
+    };
+} // namespace net
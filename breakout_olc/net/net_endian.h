@@ -0,0 +1,209 @@
+#pragma once
+
+#include "net_common.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NET_ENDIAN_SSE2
+#endif
+
+namespace net
+{
+    // Byte order conversions resolved at compile time: converting to the host
+    // order is a no-op, anything else a single bswap per value, and arrays of
+    // values are swapped 16 bytes at a time with SSE2 where available.
+    namespace endian
+    {
+        enum class order
+        {
+            little,
+            big,
+        };
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        constexpr order host = order::big;
+#else
+        constexpr order host = order::little; // x86, and arm as every target of ours configures it
+#endif
+        constexpr order network = order::big;
+
+        constexpr uint8_t byteswap(uint8_t v) { return v; }
+
+        constexpr uint16_t byteswap(uint16_t v)
+        {
+#if defined(__GNUC__)
+            return __builtin_bswap16(v);
+#else
+            return uint16_t((v >> 8) | (v << 8));
+#endif
+        }
+
+        constexpr uint32_t byteswap(uint32_t v)
+        {
+#if defined(__GNUC__)
+            return __builtin_bswap32(v);
+#else
+            return (uint32_t(byteswap(uint16_t(v))) << 16) | byteswap(uint16_t(v >> 16));
+#endif
+        }
+
+        constexpr uint64_t byteswap(uint64_t v)
+        {
+#if defined(__GNUC__)
+            return __builtin_bswap64(v);
+#else
+            return (uint64_t(byteswap(uint32_t(v))) << 32) | byteswap(uint32_t(v >> 32));
+#endif
+        }
+
+        // unsigned integer with the size of a scalar, to swap its representation
+        template <size_t Size>
+        struct bits_of;
+        template <>
+        struct bits_of<1> { typedef uint8_t type; };
+        template <>
+        struct bits_of<2> { typedef uint16_t type; };
+        template <>
+        struct bits_of<4> { typedef uint32_t type; };
+        template <>
+        struct bits_of<8> { typedef uint64_t type; };
+
+        template <typename TData>
+        struct is_scalar
+            : std::integral_constant<bool, std::is_arithmetic<TData>::value || std::is_enum<TData>::value>
+        {
+        };
+
+        template <order Order, typename TData>
+        void store(uint8_t *out, TData value)
+        {
+            static_assert(is_scalar<TData>::value, "Only scalars have a byte order.");
+            typename bits_of<sizeof(TData)>::type bits;
+            std::memcpy(&bits, &value, sizeof(TData));
+            if (Order != host)
+                bits = byteswap(bits);
+            std::memcpy(out, &bits, sizeof(TData));
+        }
+
+        template <order Order, typename TData>
+        TData load(const uint8_t *in)
+        {
+            static_assert(is_scalar<TData>::value, "Only scalars have a byte order.");
+            typename bits_of<sizeof(TData)>::type bits;
+            std::memcpy(&bits, in, sizeof(TData));
+            if (Order != host)
+                bits = byteswap(bits);
+            TData value;
+            std::memcpy(&value, &bits, sizeof(TData));
+            return value;
+        }
+
+        // reverses every Width bytes element of bytes in place
+        template <size_t Width>
+        void swapArray(uint8_t *bytes, size_t count)
+        {
+            typedef typename bits_of<Width>::type bits_type;
+            size_t i = 0;
+#if defined(NET_ENDIAN_SSE2)
+            if (Width > 1)
+            {
+                for (; i + 16 / Width <= count; i += 16 / Width)
+                {
+                    __m128i *block = reinterpret_cast<__m128i *>(bytes + i * Width);
+                    __m128i v = _mm_loadu_si128(block);
+                    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)); // bytes of each u16
+                    if (Width >= 4)
+                    {
+                        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)); // u16 halves of each u32
+                        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+                    }
+                    if (Width == 8)
+                        v = _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)); // u32 halves of each u64
+                    _mm_storeu_si128(block, v);
+                }
+            }
+#endif
+            for (; i < count; ++i)
+            {
+                bits_type bits;
+                std::memcpy(&bits, bytes + i * Width, Width);
+                bits = byteswap(bits);
+                std::memcpy(bytes + i * Width, &bits, Width);
+            }
+        }
+
+        template <order Order, typename TData>
+        void loadArray(TData *values, const uint8_t *in, size_t count)
+        {
+            static_assert(is_scalar<TData>::value, "Only scalars have a byte order.");
+            std::memcpy(values, in, count * sizeof(TData));
+            if (Order != host)
+                swapArray<sizeof(TData)>(reinterpret_cast<uint8_t *>(values), count);
+        }
+
+        template <order Order, typename TData>
+        void storeArray(uint8_t *out, const TData *values, size_t count)
+        {
+            static_assert(is_scalar<TData>::value, "Only scalars have a byte order.");
+            std::memcpy(out, values, count * sizeof(TData));
+            if (Order != host)
+                swapArray<sizeof(TData)>(out, count);
+        }
+
+        // writes fields back to back, returns the bytes written
+        template <order Order, typename... TData>
+        size_t storeFields(uint8_t *out, const TData &...fields)
+        {
+            size_t offset = 0;
+            int expand[] = {0, (store<Order>(out + offset, fields), offset += sizeof(TData), 0)...};
+            (void)expand;
+            return offset;
+        }
+
+        // reads fields back to back, returns the bytes read
+        template <order Order, typename... TData>
+        size_t loadFields(const uint8_t *in, TData &...fields)
+        {
+            size_t offset = 0;
+            int expand[] = {0, (fields = load<Order, TData>(in + offset), offset += sizeof(TData), 0)...};
+            (void)expand;
+            return offset;
+        }
+    } // namespace endian
+
+    // Wire representation of a payload type: its size on the wire and how to
+    // encode and decode it. Scalars travel in network order; aggregates get a
+    // specialization listing their fields, each with its own byte order, e.g.
+    //
+    //   template <> struct wire_codec<vec2> {
+    //       static constexpr size_t size = 8;
+    //       static void encode(uint8_t *out, const vec2 &v) { endian::storeFields<endian::network>(out, v.x, v.y); }
+    //       static vec2 decode(const uint8_t *in) { vec2 v; endian::loadFields<endian::network>(in, v.x, v.y); return v; }
+    //   };
+    template <typename T, typename Enable = void>
+    struct wire_codec;
+
+    template <typename T>
+    struct wire_codec<T, typename std::enable_if<endian::is_scalar<T>::value>::type>
+    {
+        static constexpr size_t size = sizeof(T);
+
+        static void encode(uint8_t *out, const T &value) { endian::store<endian::network>(out, value); }
+        static T decode(const uint8_t *in) { return endian::load<endian::network, T>(in); }
+    };
+
+    // decodes count values laid back to back, the scalar ones in bulk
+    template <typename T>
+    void decodeArray(T *values, const uint8_t *in, size_t count)
+    {
+        if constexpr (endian::is_scalar<T>::value)
+        {
+            endian::loadArray<endian::network>(values, in, count);
+        }
+        else
+        {
+            for (size_t i = 0; i < count; ++i)
+                values[i] = wire_codec<T>::decode(in + i * wire_codec<T>::size);
+        }
+    }
+} // namespace net
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "net_common.h"
+
+#if defined(_WIN32)
+#include <bcrypt.h> // link with -lbcrypt
+#elif defined(__linux__)
+#include <cerrno>
+#include <sys/random.h>
+#else
+#include <fstream>
+#endif
+
+namespace net
+{
+    // Bytes from the OS cryptographic generator, for secrets such as resume
+    // tokens. Not std::random_device: MinGW before GCC 9.2 implements it as a
+    // deterministic engine that yields the same sequence on every run.
+    namespace entropy
+    {
+        // false, with the reason on stderr, if the OS could not provide them
+        inline bool fill(void *out, size_t size)
+        {
+#if defined(_WIN32)
+            const NTSTATUS status = BCryptGenRandom(nullptr, static_cast<PUCHAR>(out), ULONG(size), BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+            if (status != 0)
+            {
+                std::cerr << "[ENTROPY] BCryptGenRandom failed with status " << status << ".\n";
+                return false;
+            }
+            return true;
+#elif defined(__linux__)
+            uint8_t *bytes = static_cast<uint8_t *>(out);
+            while (size > 0)
+            {
+                const ssize_t got = getrandom(bytes, size, 0);
+                if (got < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    std::cerr << "[ENTROPY] getrandom failed: " << std::strerror(errno) << "\n";
+                    return false;
+                }
+                bytes += got;
+                size -= size_t(got);
+            }
+            return true;
+#else
+            std::ifstream urandom("/dev/urandom", std::ios::binary);
+            if (!urandom.read(static_cast<char *>(out), std::streamsize(size)))
+            {
+                std::cerr << "[ENTROPY] Cannot read /dev/urandom.\n";
+                return false;
+            }
+            return true;
+#endif
+        }
+    } // namespace entropy
+} // namespace net
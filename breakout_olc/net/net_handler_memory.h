@@ -0,0 +1,109 @@
+#pragma once
+
+#include "net_common.h"
+
+namespace net
+{
+    // Recycled storage for the completion handlers of one chain of async
+    // operations (asio's custom allocation hooks). A chain has at most one
+    // operation pending, and asio frees an operation's memory before invoking
+    // its handler, so one block is enough; anything bigger or concurrent falls
+    // back to the heap.
+    class handler_memory
+    {
+    public:
+        handler_memory() = default;
+        handler_memory(const handler_memory &) = delete;
+
+    public:
+        void *allocate(size_t size)
+        {
+            if (!this->inUse && size <= sizeof(this->storage))
+            {
+                this->inUse = true;
+                return &this->storage;
+            }
+            return ::operator new(size);
+        }
+
+        void deallocate(void *pointer)
+        {
+            if (pointer == &this->storage)
+                this->inUse = false;
+            else
+                ::operator delete(pointer);
+        }
+
+    private:
+        alignas(std::max_align_t) unsigned char storage[512];
+        bool inUse = false;
+    };
+
+    template <typename TValue>
+    class handler_allocator
+    {
+    public:
+        typedef TValue value_type;
+
+        explicit handler_allocator(handler_memory &memory) : memory(memory)
+        {
+        }
+
+        template <typename TOther>
+        handler_allocator(const handler_allocator<TOther> &other) noexcept : memory(other.memory)
+        {
+        }
+
+        TValue *allocate(size_t n) const
+        {
+            return static_cast<TValue *>(this->memory.allocate(sizeof(TValue) * n));
+        }
+
+        void deallocate(TValue *pointer, size_t) const
+        {
+            this->memory.deallocate(pointer);
+        }
+
+        bool operator==(const handler_allocator &other) const noexcept { return &this->memory == &other.memory; }
+        bool operator!=(const handler_allocator &other) const noexcept { return &this->memory != &other.memory; }
+
+    private:
+        template <typename>
+        friend class handler_allocator;
+
+        handler_memory &memory;
+    };
+
+    // wraps a handler so that asio allocates its operations from memory
+    template <typename THandler>
+    class custom_alloc_handler
+    {
+    public:
+        typedef handler_allocator<THandler> allocator_type;
+
+        custom_alloc_handler(handler_memory &memory, THandler handler) : memory(memory), handler(std::move(handler))
+        {
+        }
+
+        allocator_type get_allocator() const noexcept
+        {
+            return allocator_type(this->memory);
+        }
+
+        template <typename... TArgs>
+        void operator()(TArgs &&...args)
+        {
+            this->handler(std::forward<TArgs>(args)...);
+        }
+
+    private:
+        handler_memory &memory;
+        THandler handler;
+    };
+
+    template <typename THandler>
+    custom_alloc_handler<typename std::decay<THandler>::type> makeCustomAllocHandler(handler_memory &memory, THandler &&handler)
+    {
+        return custom_alloc_handler<typename std::decay<THandler>::type>(memory, std::forward<THandler>(handler));
+    }
+} // namespace net
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "net_common.h"
+
+namespace net
+{
+    // Log-linear histogram of durations in nanoseconds, in the spirit of
+    // HdrHistogram: 32 linear sub-buckets per power of two, i.e. about 3%
+    // relative precision over the whole uint64_t range in 15 KB. Recording is
+    // a couple of relaxed atomic increments, so any thread may record while
+    // another one reads percentiles (which are then approximate).
+    class latency_histogram
+    {
+    public:
+        latency_histogram()
+        {
+            this->reset();
+        }
+        latency_histogram(const latency_histogram &) = delete;
+
+    public:
+        void record(uint64_t value)
+        {
+            this->buckets[indexOf(value)].fetch_add(1, std::memory_order_relaxed);
+            this->total.fetch_add(1, std::memory_order_relaxed);
+            uint64_t current = this->maxValue.load(std::memory_order_relaxed);
+            while (value > current && !this->maxValue.compare_exchange_weak(current, value, std::memory_order_relaxed))
+                ;
+        }
+
+        uint64_t count() const { return this->total.load(std::memory_order_relaxed); }
+        uint64_t max() const { return this->maxValue.load(std::memory_order_relaxed); }
+
+        // upper bound of the bucket holding the given percentile (in [0, 100]), 0 if empty
+        uint64_t percentile(double p) const
+        {
+            const uint64_t samples = this->count();
+            if (samples == 0)
+                return 0;
+
+            const uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(p / 100.0 * double(samples))));
+            uint64_t seen = 0;
+            for (size_t i = 0; i < bucketCount; ++i)
+            {
+                seen += this->buckets[i].load(std::memory_order_relaxed);
+                if (seen >= rank)
+                    return std::min(valueOf(i), this->max());
+            }
+            return this->max();
+        }
+
+        void reset()
+        {
+            for (std::atomic<uint64_t> &bucket : this->buckets)
+                bucket.store(0, std::memory_order_relaxed);
+            this->total.store(0, std::memory_order_relaxed);
+            this->maxValue.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        static constexpr unsigned subBits = 5;
+        static constexpr uint64_t subCount = uint64_t(1) << subBits;
+        static constexpr size_t bucketCount = (64 - subBits + 1) * subCount;
+
+        std::atomic<uint64_t> buckets[bucketCount];
+        std::atomic<uint64_t> total{0};
+        std::atomic<uint64_t> maxValue{0};
+
+        static size_t indexOf(uint64_t value)
+        {
+            if (value < subCount)
+                return size_t(value);
+            const unsigned shift = 63 - unsigned(__builtin_clzll(value)) - subBits;
+            return size_t((shift + 1) * subCount + ((value >> shift) - subCount));
+        }
+
+        static uint64_t valueOf(size_t index)
+        {
+            if (index < subCount)
+                return index;
+            const unsigned shift = unsigned(index / subCount) - 1;
+            const uint64_t lower = (subCount + index % subCount) << shift;
+            return lower + ((uint64_t(1) << shift) - 1);
+        }
+    };
+
+    // one line per histogram, durations in microseconds
+    inline void printHistogramHeader(std::ostream &os, const char *tag)
+    {
+        char line[96];
+        std::snprintf(line, sizeof(line), "[%s] %-10s %8s %10s %10s %10s\n", tag, "stage", "count", "p50(us)", "p99(us)", "max(us)");
+        os << line;
+    }
+
+    inline void printHistogram(std::ostream &os, const char *tag, const char *name, const latency_histogram &histogram)
+    {
+        char line[96];
+        std::snprintf(line, sizeof(line), "[%s] %-10s %8llu %10.1f %10.1f %10.1f\n", tag, name, (unsigned long long)histogram.count(),
+                      histogram.percentile(50) / 1e3, histogram.percentile(99) / 1e3, histogram.max() / 1e3);
+        os << line;
+    }
+} // namespace net
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_histogram.h"
+
+namespace net
+{
+    // Heartbeat of a server connection: a ServerPing every interval, which the
+    // client echoes back. Without any bytes from the remote for timeout the
+    // connection is closed as if the socket failed. Legacy remotes cannot
+    // answer pings, for them the timeout is on silence alone.
+    struct heartbeat_config
+    {
+        std::chrono::milliseconds interval{0};   // 0: no heartbeat at all
+        std::chrono::milliseconds timeout{0};    // 0: never close on silence
+        std::chrono::milliseconds rttLimit{100}; // above it (smoothed) the link counts as degraded
+    };
+
+    // Health of the link to a remote, fed by the heartbeat of its connection.
+    // Only the connection's strand writes, any thread may read.
+    class link_stats
+    {
+    public:
+        link_stats() = default;
+        link_stats(const link_stats &) = delete;
+
+    public:
+        // strand only
+        void start(const heartbeat_config &config, uint64_t now)
+        {
+            this->rttLimit = uint64_t(std::chrono::nanoseconds(config.rttLimit).count());
+            this->silenceLimit = 2 * uint64_t(std::chrono::nanoseconds(config.interval).count()); // two pings unanswered
+            this->lastHeard.store(now, std::memory_order_relaxed);
+            this->enabled.store(true, std::memory_order_release);
+        }
+
+        void heard(uint64_t now) { this->lastHeard.store(now, std::memory_order_relaxed); }
+
+        void pingSent() { this->pings.store(this->pings.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); }
+
+        // smoothed rtt as TCP does (gain 1/8), jitter as RTP does (mean rtt change, gain 1/16)
+        void pongReceived(uint64_t rtt)
+        {
+            this->rttHistogram.record(rtt);
+            const uint64_t previous = this->last.exchange(rtt, std::memory_order_relaxed);
+            const uint64_t pongCount = this->pongs.load(std::memory_order_relaxed) + 1;
+            this->pongs.store(pongCount, std::memory_order_relaxed);
+            if (pongCount == 1)
+            {
+                this->smoothed.store(rtt, std::memory_order_relaxed);
+                return;
+            }
+
+            const int64_t srtt = int64_t(this->smoothed.load(std::memory_order_relaxed));
+            this->smoothed.store(uint64_t(srtt + (int64_t(rtt) - srtt) / 8), std::memory_order_relaxed);
+            const int64_t change = std::abs(int64_t(rtt) - int64_t(previous));
+            const int64_t jitterNow = int64_t(this->jitterEwma.load(std::memory_order_relaxed));
+            this->jitterEwma.store(uint64_t(jitterNow + (change - jitterNow) / 16), std::memory_order_relaxed);
+        }
+
+    public:
+        bool isEnabled() const { return this->enabled.load(std::memory_order_acquire); }
+
+        // ns
+        uint64_t rtt() const { return this->smoothed.load(std::memory_order_relaxed); }
+        uint64_t lastRtt() const { return this->last.load(std::memory_order_relaxed); }
+        uint64_t jitter() const { return this->jitterEwma.load(std::memory_order_relaxed); }
+        uint64_t silence(uint64_t now) const
+        {
+            const uint64_t heardAt = this->lastHeard.load(std::memory_order_relaxed);
+            return now > heardAt ? now - heardAt : 0;
+        }
+
+        uint64_t pingsSent() const { return this->pings.load(std::memory_order_relaxed); }
+        uint64_t pongsReceived() const { return this->pongs.load(std::memory_order_relaxed); }
+        const latency_histogram &rtts() const { return this->rttHistogram; }
+
+        // rtt over the limit or the remote quiet for two heartbeats; never with the heartbeat off
+        bool degraded(uint64_t now) const
+        {
+            if (!this->isEnabled())
+                return false;
+            return this->rtt() > this->rttLimit || this->silence(now) > this->silenceLimit;
+        }
+
+    private:
+        std::atomic<bool> enabled{false};
+        uint64_t rttLimit = 0;     // ns, set before enabled is published
+        uint64_t silenceLimit = 0; // ns, likewise
+        std::atomic<uint64_t> lastHeard{0};
+        std::atomic<uint64_t> smoothed{0};
+        std::atomic<uint64_t> last{0};
+        std::atomic<uint64_t> jitterEwma{0};
+        std::atomic<uint64_t> pings{0};
+        std::atomic<uint64_t> pongs{0};
+        latency_histogram rttHistogram;
+    };
+} // namespace net
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_spsc_queue.h"
+
+namespace net
+{
+    // Single-writer, multi-reader latest-value cell (seqlock).
+    // The writer never waits; readers retry only if they race a store, so a
+    // load costs a couple of atomic loads plus a copy of T. Intermediate values
+    // are simply overwritten, which is what latest-wins samples want.
+    template <typename T>
+    class mailbox
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "Mailbox values must be trivially copyable.");
+
+    public:
+        mailbox()
+        {
+            uint64_t words[wordCount] = {};
+            const T initial{};
+            std::memcpy(words, &initial, sizeof(T));
+            for (size_t i = 0; i < wordCount; ++i)
+                this->data[i].store(words[i], std::memory_order_relaxed);
+        }
+        mailbox(const mailbox<T> &) = delete;
+
+    public:
+        void store(const T &value)
+        {
+            uint64_t words[wordCount] = {};
+            std::memcpy(words, &value, sizeof(T));
+
+            const uint64_t seq = this->sequence.load(std::memory_order_relaxed);
+            this->sequence.store(seq + 1, std::memory_order_relaxed); // odd: write in progress
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < wordCount; ++i)
+                this->data[i].store(words[i], std::memory_order_relaxed);
+            this->sequence.store(seq + 2, std::memory_order_release);
+        }
+
+        T load() const
+        {
+            T value;
+            this->load(value);
+            return value;
+        }
+
+        // returns the version of the value read, which only grows with each store
+        uint64_t load(T &value) const
+        {
+            uint64_t words[wordCount];
+            uint64_t before, after;
+            do
+            {
+                before = this->sequence.load(std::memory_order_acquire);
+                for (size_t i = 0; i < wordCount; ++i)
+                    words[i] = this->data[i].load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                after = this->sequence.load(std::memory_order_relaxed);
+            } while ((before & 1) || before != after);
+
+            std::memcpy(&value, words, sizeof(T));
+            return before / 2;
+        }
+
+        uint64_t version() const { return this->sequence.load(std::memory_order_acquire) / 2; }
+
+    private:
+        static constexpr size_t wordCount = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+        alignas(cache_line_size) std::atomic<uint64_t> sequence{0};
+        std::atomic<uint64_t> data[wordCount];
+    };
+} // namespace net
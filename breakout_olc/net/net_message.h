@@ -1,35 +1,128 @@
 #pragma once
 
 #include "net_common.h"
+#include "net_endian.h"
+#include "net_buffer.h"
 
 namespace net
 {
     enum class msgType : uint32_t
     {
-        ServerAccept,
+        ServerAccept, // payload: protocol version (u32), client id (u32), resume token (u64)
         ServerDeny,
-        ServerPing,
+        ServerPing, // payload: sequence (u32), server send time (u64); echoed with the client receive time (u64)
         MessageAll,
         ServerMessage,
+        Hello,     // client handshake, payload: protocol version (u32), optionally the resume token of a previous connection (u64)
+        Command,   // payload: one T
+        Control,   // payload: control_message
+        Telemetry, // payload: application defined
+        Closed,    // never on the wire: queued locally when a connection fails
+        ShmAttach, // payload: name of a shm segment carrying the commands (same host only)
     };
 
+    enum class msgChannel : uint8_t
+    {
+        system,    // handshake and pings
+        command,   // latest-wins samples
+        control,   // session control
+        telemetry, // feedback to the remote
+    };
+
+    // big-endian helpers for the framed protocol
+    namespace wire
+    {
+        inline void putU16(uint8_t *out, uint16_t v) { endian::store<endian::network>(out, v); }
+        inline void putU32(uint8_t *out, uint32_t v) { endian::store<endian::network>(out, v); }
+        inline void putU64(uint8_t *out, uint64_t v) { endian::store<endian::network>(out, v); }
+
+        inline uint16_t getU16(const uint8_t *in) { return endian::load<endian::network, uint16_t>(in); }
+        inline uint32_t getU32(const uint8_t *in) { return endian::load<endian::network, uint32_t>(in); }
+        inline uint64_t getU64(const uint8_t *in) { return endian::load<endian::network, uint64_t>(in); }
+    } // namespace wire
+
+    // Framed protocol (v2). A client opts in by sending the 4 magic bytes
+    // followed by a Hello frame; anything else is taken as the legacy stream
+    // of naked big-endian T values. The magic reads as a NaN if interpreted as
+    // a legacy float, so it can never be confused with a real command.
+    namespace protocol
+    {
+        constexpr uint32_t version = 2;
+        constexpr uint8_t magic[4] = {0xFF, 0xC2, 'R', 'G'};
+        constexpr size_t headerSize = 16; // type, channel, size (u16), sequence (u32), timestamp (u64)
+        constexpr size_t maxPayloadSize = 1024;
+        constexpr size_t inlinePayloadSize = 64; // payloads up to this size never touch the heap
+
+        inline uint64_t timestampNow()
+        {
+            return uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now().time_since_epoch())
+                                .count());
+        }
+    } // namespace protocol
+
     template <typename T>
     struct message_header
     {
     public:
-        T id{};
+        msgType id = msgType::ServerMessage;
+        msgChannel channel = msgChannel::system;
+        uint32_t sequence = 0;  // per connection and direction, set when sent
+        uint64_t timestamp = 0; // sender steady clock (ns), set when sent
         uint32_t size = 0;
+
+        void encode(uint8_t *out) const
+        {
+            out[0] = uint8_t(this->id);
+            out[1] = uint8_t(this->channel);
+            wire::putU16(out + 2, uint16_t(this->size));
+            wire::putU32(out + 4, this->sequence);
+            wire::putU64(out + 8, this->timestamp);
+        }
+
+        static message_header<T> decode(const uint8_t *in)
+        {
+            message_header<T> header;
+            header.id = msgType(in[0]);
+            header.channel = msgChannel(in[1]);
+            header.size = wire::getU16(in + 2);
+            header.sequence = wire::getU32(in + 4);
+            header.timestamp = wire::getU64(in + 8);
+            return header;
+        }
+    };
+
+    // payload of Control frames, big-endian; delivered ahead of the commands
+    // queued before it (see server_interface::update)
+    struct control_message
+    {
+        uint32_t code = 0; // application defined
+        int32_t arg = 0;
+
+        static constexpr size_t size = 8;
+
+        void encode(uint8_t *out) const
+        {
+            wire::putU32(out, this->code);
+            wire::putU32(out + 4, uint32_t(this->arg));
+        }
+
+        static control_message decode(const uint8_t *in)
+        {
+            control_message control;
+            control.code = wire::getU32(in);
+            control.arg = int32_t(wire::getU32(in + 4));
+            return control;
+        }
     };
 
+    typedef small_buffer<protocol::inlinePayloadSize> message_body;
+
     template <typename T>
     struct message
     {
         message_header<T> header{};
-#ifdef QUEUE_MSGS_IMPLEMENTATION
-        std::queue<uint8_t> body;
-#else
-        std::vector<uint8_t> body;
-#endif
+        message_body body;
 
         size_t size() const
         {
@@ -38,16 +131,39 @@ namespace net
 
         void resizeBody(std::size_t sz)
         {
-#ifdef QUEUE_MSGS_IMPLEMENTATION
-            // do nothing
-#else
             this->body.resize(sz);
-#endif
+        }
+
+        // appends all fields at once, growing the body at most once
+        template <typename... TData>
+        message<T> &append(const TData &...fields)
+        {
+            this->body.reserve(this->body.size() + sumOfSizes<TData...>());
+            int expand[] = {0, (*this << fields, 0)...};
+            (void)expand;
+            return *this;
+        }
+
+        // appends value in its wire representation (see wire_codec)
+        template <typename TData>
+        message<T> &encode(const TData &value)
+        {
+            uint8_t bytes[wire_codec<TData>::size];
+            wire_codec<TData>::encode(bytes, value);
+            this->body.append(bytes, sizeof(bytes));
+            this->header.size = this->size();
+            return *this;
+        }
+
+        // forward cursor over the body, in the order the fields were written
+        message_reader reader() const
+        {
+            return message_reader(this->body);
         }
 
         friend std::ostream &operator<<(std::ostream &os, const message<T> &msg)
         {
-            os << "Message { Id = " << msg.header.id
+            os << "Message { Id = " << uint32_t(msg.header.id)
                << ", Size = " << msg.header.size << " }";
             return os;
         }
@@ -58,22 +174,15 @@ namespace net
             // check data type is trivially copiable
             static_assert(std::is_standard_layout<TData>::value, "Data is too complex for message.");
 
-            // resize and copy into vector
-#ifdef QUEUE_MSGS_IMPLEMENTATION
-            const uint8_t *bytes = (uint8_t *)&data;
-            for (size_t i = 0; i < sizeof(TData); ++i)
-                msg.body.push(*(bytes + i));
-#else
-            size_t current_size = msg.body.size();
-            msg.body.resize(current_size + sizeof(TData));
-            std::memcpy(msg.body.data() + current_size, &data, sizeof(TData));
-#endif
+            // copy at the end of the body
+            msg.body.append(&data, sizeof(TData));
 
             // update size
             msg.header.size = msg.size();
             return msg;
         }
 
+        // pops from the end of the body, i.e. the last field written comes out first
         template <typename TData>
         friend message<T> &operator>>(message<T> &msg, TData &data)
         {
@@ -84,41 +193,49 @@ namespace net
             if (msg.body.empty() || msg.body.size() < sizeof(TData))
                 throw std::invalid_argument("Message body cannot be copied into data: not enough bytes.");
 
-// copy from vector and resize
-#ifdef QUEUE_MSGS_IMPLEMENTATION
-            uint8_t *bytes = (uint8_t *)&data;
-            for (size_t i = 0; i < sizeof(TData); ++i)
-            {
-                *(bytes + i) = msg.body.front();
-                msg.body.pop();
-            }
-#else
+            // copy from the end and shrink, which keeps the storage
             size_t new_size = msg.body.size() - sizeof(TData);
             std::memcpy(&data, msg.body.data() + new_size, sizeof(TData));
-            msg.body.resize(new_size);
-#endif
+            msg.body.truncate(new_size);
 
             // update size
             msg.header.size = msg.size();
             return msg;
         }
-    };
 
-    template <typename T>
-    struct connection; // forward declaration
+    private:
+        template <typename... TData>
+        static constexpr size_t sumOfSizes()
+        {
+            size_t sum = 0;
+            for (size_t size : {size_t(0), sizeof(TData)...})
+                sum += size;
+            return sum;
+        }
+    };
 
+    // a msg and the id of the connection it came from; the server resolves the id
+    // when dispatching, so queueing a msg never touches a reference count
     template <typename T>
     struct owned_message
     {
-        std::shared_ptr<connection<T>> remote = nullptr;
-        T msg;
+        uint32_t remoteId = 0;
+        message_header<T> header{}; // legacy frames get a default Command header
+        T msg;                      // payload of Command frames
+        message_body body;          // payload of any other frame, in wire order
+        uint64_t received = 0;      // protocol::timestampNow() when it was decoded
+
+        message_reader reader() const
+        {
+            return message_reader(this->body);
+        }
 
         friend std::ostream &
         operator<<(std::ostream &os, const owned_message<T> &owned_msg)
         {
-            os << "Message { Id = " << owned_msg.msg.header.id
-               << ", Size = " << owned_msg.msg.header.size
-               << ", Remote = " << *(owned_msg.remote.get()) << " }";
+            os << "Message { Id = " << uint32_t(owned_msg.header.id)
+               << ", Size = " << owned_msg.header.size
+               << ", Remote = " << owned_msg.remoteId << " }";
             return os;
         }
     };
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <sstream>
+#include <stdexcept>
+#include "net_common.h"
+
+namespace net
+{
+    // Metrics are sharded per thread: each thread updates the shard of its own
+    // index (given round robin on first use) with a relaxed atomic add, so that
+    // hot paths never contend on a cache line or take a lock. Reading sums the
+    // shards, which is only done when the metrics are exported.
+    static constexpr size_t metricsShardCount = 16;
+
+    inline size_t metricsShard()
+    {
+        static std::atomic<size_t> nextShard{0};
+        thread_local const size_t shard = nextShard.fetch_add(1, std::memory_order_relaxed) % metricsShardCount;
+        return shard;
+    }
+
+    // monotonic count of events
+    class metric_counter
+    {
+    public:
+        metric_counter() = default;
+        metric_counter(const metric_counter &) = delete;
+
+    public:
+        void add(uint64_t n = 1) { this->shards[metricsShard()].value.fetch_add(n, std::memory_order_relaxed); }
+
+        uint64_t value() const
+        {
+            uint64_t sum = 0;
+            for (const shard &cell : this->shards)
+                sum += cell.value.load(std::memory_order_relaxed);
+            return sum;
+        }
+
+    private:
+        struct alignas(cache_line_size) shard
+        {
+            std::atomic<uint64_t> value{0};
+        };
+        shard shards[metricsShardCount];
+    };
+
+    // current level of something, set or moved by any thread; one value, as
+    // gauges are set rather than accumulated
+    class metric_gauge
+    {
+    public:
+        metric_gauge() = default;
+        metric_gauge(const metric_gauge &) = delete;
+
+    public:
+        void set(int64_t value) { this->current.store(value, std::memory_order_relaxed); }
+        void add(int64_t delta) { this->current.fetch_add(delta, std::memory_order_relaxed); }
+        int64_t value() const { return this->current.load(std::memory_order_relaxed); }
+
+    private:
+        alignas(cache_line_size) std::atomic<int64_t> current{0};
+    };
+
+    // distribution of durations in nanoseconds over power of two buckets from
+    // 1 us to about 1 s, exported in seconds as a Prometheus histogram
+    class metric_histogram
+    {
+    public:
+        static constexpr size_t bucketCount = 21; // upper bounds 1 us << i, then +Inf
+
+        metric_histogram() = default;
+        metric_histogram(const metric_histogram &) = delete;
+
+    public:
+        void observe(uint64_t ns)
+        {
+            shard &cell = this->shards[metricsShard()];
+            cell.buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+            cell.sum.fetch_add(ns, std::memory_order_relaxed);
+        }
+
+        static uint64_t upperBound(size_t bucket) { return uint64_t(1000) << bucket; }
+
+        // observations at or below upperBound(bucket), or all of them for bucketCount
+        uint64_t cumulative(size_t bucket) const
+        {
+            uint64_t total = 0;
+            for (const shard &cell : this->shards)
+                for (size_t i = 0; i <= bucket; ++i)
+                    total += cell.buckets[i].load(std::memory_order_relaxed);
+            return total;
+        }
+
+        uint64_t count() const { return this->cumulative(bucketCount); }
+
+        uint64_t sum() const
+        {
+            uint64_t total = 0;
+            for (const shard &cell : this->shards)
+                total += cell.sum.load(std::memory_order_relaxed);
+            return total;
+        }
+
+    private:
+        struct alignas(cache_line_size) shard
+        {
+            std::atomic<uint64_t> buckets[bucketCount + 1]{};
+            std::atomic<uint64_t> sum{0};
+        };
+        shard shards[metricsShardCount];
+
+        static size_t bucketOf(uint64_t ns)
+        {
+            size_t bucket = 0;
+            while (bucket < bucketCount && ns > upperBound(bucket))
+                bucket++;
+            return bucket;
+        }
+    };
+
+    enum class metric_type
+    {
+        counter,
+        gauge,
+        histogram,
+    };
+
+    // Named metrics of the process, rendered in the Prometheus text format.
+    // Registering looks a metric up by name and returns the same object to
+    // every caller, so components fetch their metrics once and then only touch
+    // the metric itself, without any lock. Registration and rendering are
+    // serialized by a mutex; metrics live as long as the registry.
+    //
+    // A sampled metric is read from a callback when rendered, for levels that
+    // something else already keeps (queue depth, active sessions); its owner
+    // must remove it before the state it reads goes away.
+    class metrics_registry
+    {
+    public:
+        metrics_registry() = default;
+        metrics_registry(const metrics_registry &) = delete;
+
+        static metrics_registry &global()
+        {
+            static metrics_registry registry;
+            return registry;
+        }
+
+    public:
+        metric_counter &counter(const std::string &name, const std::string &help)
+        {
+            return *this->find(name, help, metric_type::counter).counter;
+        }
+
+        metric_gauge &gauge(const std::string &name, const std::string &help)
+        {
+            return *this->find(name, help, metric_type::gauge).gauge;
+        }
+
+        metric_histogram &histogram(const std::string &name, const std::string &help)
+        {
+            return *this->find(name, help, metric_type::histogram).histogram;
+        }
+
+        // replaces any sampled metric of that name
+        void sampled(const std::string &name, const std::string &help, metric_type type, std::function<double()> sample)
+        {
+            const std::lock_guard<std::mutex> lock(this->mtx);
+            for (entry &metric : this->sampledMetrics)
+            {
+                if (metric.name == name)
+                {
+                    metric.sample = std::move(sample);
+                    return;
+                }
+            }
+            entry metric;
+            metric.name = name;
+            metric.help = help;
+            metric.type = type;
+            metric.sample = std::move(sample);
+            this->sampledMetrics.push_back(std::move(metric));
+        }
+
+        void removeSampled(const std::string &name)
+        {
+            const std::lock_guard<std::mutex> lock(this->mtx);
+            this->sampledMetrics.erase(std::remove_if(this->sampledMetrics.begin(), this->sampledMetrics.end(),
+                                                      [&name](const entry &metric) { return metric.name == name; }),
+                                       this->sampledMetrics.end());
+        }
+
+        void render(std::ostream &os)
+        {
+            const std::lock_guard<std::mutex> lock(this->mtx);
+            for (const std::unique_ptr<entry> &metric : this->metrics)
+            {
+                describe(os, *metric);
+                if (metric->type == metric_type::counter)
+                    os << metric->name << ' ' << metric->counter->value() << '\n';
+                else if (metric->type == metric_type::gauge)
+                    os << metric->name << ' ' << metric->gauge->value() << '\n';
+                else
+                    renderHistogram(os, metric->name, *metric->histogram);
+            }
+            for (const entry &metric : this->sampledMetrics)
+            {
+                describe(os, metric);
+                char value[32];
+                std::snprintf(value, sizeof(value), "%.17g", metric.sample());
+                os << metric.name << ' ' << value << '\n';
+            }
+        }
+
+        std::string render()
+        {
+            std::ostringstream os;
+            this->render(os);
+            return os.str();
+        }
+
+    private:
+        struct entry
+        {
+            std::string name;
+            std::string help;
+            metric_type type = metric_type::counter;
+            std::unique_ptr<metric_counter> counter;
+            std::unique_ptr<metric_gauge> gauge;
+            std::unique_ptr<metric_histogram> histogram;
+            std::function<double()> sample;
+        };
+
+        std::mutex mtx;
+        std::vector<std::unique_ptr<entry>> metrics; // never removed, handed out by reference
+        std::vector<entry> sampledMetrics;
+
+        entry &find(const std::string &name, const std::string &help, metric_type type)
+        {
+            const std::lock_guard<std::mutex> lock(this->mtx);
+            for (const std::unique_ptr<entry> &metric : this->metrics)
+            {
+                if (metric->name != name)
+                    continue;
+                if (metric->type != type)
+                    throw std::invalid_argument("metric " + name + " registered with another type");
+                return *metric;
+            }
+
+            std::unique_ptr<entry> metric(new entry());
+            metric->name = name;
+            metric->help = help;
+            metric->type = type;
+            if (type == metric_type::counter)
+                metric->counter.reset(new metric_counter());
+            else if (type == metric_type::gauge)
+                metric->gauge.reset(new metric_gauge());
+            else
+                metric->histogram.reset(new metric_histogram());
+            this->metrics.push_back(std::move(metric));
+            return *this->metrics.back();
+        }
+
+        static void describe(std::ostream &os, const entry &metric)
+        {
+            static const char *types[] = {"counter", "gauge", "histogram"};
+            os << "# HELP " << metric.name << ' ' << metric.help << '\n'
+               << "# TYPE " << metric.name << ' ' << types[size_t(metric.type)] << '\n';
+        }
+
+        static void renderHistogram(std::ostream &os, const std::string &name, const metric_histogram &histogram)
+        {
+            char line[160];
+            for (size_t i = 0; i < metric_histogram::bucketCount; ++i)
+            {
+                std::snprintf(line, sizeof(line), "%s_bucket{le=\"%g\"} %llu\n", name.c_str(), metric_histogram::upperBound(i) / 1e9,
+                              (unsigned long long)histogram.cumulative(i));
+                os << line;
+            }
+            // read last, so that it is never below a bucket read before
+            const uint64_t count = histogram.count();
+            std::snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %llu\n%s_sum %.9f\n%s_count %llu\n", name.c_str(),
+                          (unsigned long long)count, name.c_str(), histogram.sum() / 1e9, name.c_str(), (unsigned long long)count);
+            os << line;
+        }
+    };
+
+    // Metrics of the transport, shared by every server and connection of the process.
+    struct transport_metrics
+    {
+        metric_counter &connectionsAccepted;
+        metric_counter &connectionsDenied;
+        metric_counter &bytesReceived;
+        metric_counter &bytesSent;
+        metric_counter &commandsReceived;
+        metric_counter &framesReceived;
+        metric_counter &protocolErrors;
+        metric_counter &linkTimeouts;
+        metric_counter &commandsDispatched;
+        metric_counter &telemetryOverwritten;
+        metric_histogram &rtt;
+
+        static transport_metrics &get()
+        {
+            static transport_metrics metrics(metrics_registry::global());
+            return metrics;
+        }
+
+    private:
+        explicit transport_metrics(metrics_registry &registry)
+            : connectionsAccepted(registry.counter("net_connections_accepted_total", "Connections approved by the server.")),
+              connectionsDenied(registry.counter("net_connections_denied_total", "Connections refused by the server.")),
+              bytesReceived(registry.counter("net_bytes_received_total", "Bytes read from the tcp connections.")),
+              bytesSent(registry.counter("net_bytes_sent_total", "Bytes written to the tcp connections.")),
+              commandsReceived(registry.counter("net_commands_received_total", "Commands decoded by the connections.")),
+              framesReceived(registry.counter("net_frames_received_total", "Other frames decoded by the connections.")),
+              protocolErrors(registry.counter("net_protocol_errors_total", "Connections closed on a malformed stream.")),
+              linkTimeouts(registry.counter("net_link_timeouts_total", "Connections closed after a silent heartbeat timeout.")),
+              commandsDispatched(registry.counter("net_commands_dispatched_total", "Commands dispatched by the server thread.")),
+              telemetryOverwritten(registry.counter("net_telemetry_overwritten_total", "Telemetry msgs replaced before they were sent.")),
+              rtt(registry.histogram("net_rtt_seconds", "Round trip of the heartbeat pings."))
+        {
+        }
+    };
+} // namespace net
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_metrics.h"
+
+namespace net
+{
+    // Minimal HTTP/1.0 server answering GET /metrics with the registry in the
+    // Prometheus text format, on the io_context of its owner: a scrape is a few
+    // handlers on the asio threads, nothing runs between scrapes. Listens on
+    // the loopback only; one request per connection, closed after the answer
+    // or once exchangeTimeout is over, so an idle peer cannot hold its socket.
+    class metrics_endpoint
+    {
+    public:
+        static constexpr size_t maxRequestSize = 4096;
+        static constexpr std::chrono::seconds exchangeTimeout{5};
+
+        metrics_endpoint(asio::io_context &context, uint16_t port, metrics_registry &registry = metrics_registry::global())
+            : acceptor(context, asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port)), registry(registry)
+        {
+        }
+        metrics_endpoint(const metrics_endpoint &) = delete;
+
+        ~metrics_endpoint()
+        {
+            asio::error_code ec;
+            this->acceptor.close(ec);
+        }
+
+    public:
+        void start()
+        {
+            std::cout << "[METRICS] Serving http://127.0.0.1:" << this->acceptor.local_endpoint().port() << "/metrics\n";
+            this->acceptAsync();
+        }
+
+    private:
+        // its socket is bound to a strand of its own, which the deadline shares
+        struct exchange
+        {
+            explicit exchange(asio::ip::tcp::socket socket) : socket(std::move(socket)), deadline(this->socket.get_executor()) {}
+
+            asio::ip::tcp::socket socket;
+            asio::steady_timer deadline;
+            std::string request;
+            std::string response;
+
+            void close()
+            {
+                asio::error_code ignored;
+                this->deadline.cancel();
+                this->socket.shutdown(asio::ip::tcp::socket::shutdown_both, ignored);
+                this->socket.close(ignored);
+            }
+        };
+
+        asio::ip::tcp::acceptor acceptor;
+        metrics_registry &registry;
+
+        void acceptAsync()
+        {
+            this->acceptor.async_accept(asio::make_strand(this->acceptor.get_executor()), [this](std::error_code ec, asio::ip::tcp::socket socket) {
+                if (ec == asio::error::operation_aborted)
+                    return;
+                if (!ec)
+                {
+                    std::shared_ptr<exchange> current = std::make_shared<exchange>(std::move(socket));
+                    asio::dispatch(current->socket.get_executor(), [this, current]() { this->readAsync(current); });
+                }
+                this->acceptAsync();
+            });
+        }
+
+        // on the strand of the exchange
+        void readAsync(std::shared_ptr<exchange> current)
+        {
+            current->deadline.expires_after(exchangeTimeout);
+            current->deadline.async_wait([current](std::error_code ec) {
+                if (!ec)
+                    current->close();
+            });
+            asio::async_read_until(current->socket, asio::dynamic_buffer(current->request, maxRequestSize), "\r\n\r\n",
+                                   [this, current](std::error_code ec, std::size_t) {
+                                       if (!ec)
+                                           this->respond(current);
+                                       else
+                                           current->close();
+                                   });
+        }
+
+        void respond(std::shared_ptr<exchange> current)
+        {
+            const bool scrape = current->request.compare(0, 13, "GET /metrics ") == 0 ||
+                                current->request.compare(0, 13, "GET /metrics?") == 0;
+            const std::string body = scrape ? this->registry.render() : "not found, try /metrics\n";
+
+            current->response = scrape ? "HTTP/1.0 200 OK\r\n" : "HTTP/1.0 404 Not Found\r\n";
+            current->response += "Content-Type: text/plain; version=0.0.4\r\n"
+                                 "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                                 "Connection: close\r\n\r\n";
+            current->response += body;
+
+            asio::async_write(current->socket, asio::buffer(current->response), [current](std::error_code, std::size_t) {
+                current->close();
+            });
+        }
+    };
+} // namespace net
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_spsc_queue.h"
+#include "net_wait_signal.h"
+
+namespace net
+{
+    // Bounded, lock-free multi-producer/single-consumer ring buffer (Vyukov's
+    // per-slot sequence scheme). Producers claim a slot with one CAS on the
+    // tail, the consumer never touches shared counters. Same interface as
+    // spsc_queue, so it can be used as msgsIn when several threads produce
+    // (multiple I/O threads, UDP or shared memory receivers).
+    template <typename T, size_t Capacity = 1024, wait_policy Policy = wait_policy::block>
+    class mpsc_queue
+    {
+        static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two.");
+
+    public:
+        mpsc_queue()
+        {
+            for (size_t i = 0; i < Capacity; ++i)
+                this->slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        mpsc_queue(const mpsc_queue<T, Capacity, Policy> &) = delete;
+
+    public:
+        // any thread; returns false (and drops the item) if the ring is full
+        bool push_back(const T &item)
+        {
+            slot *cell;
+            size_t pos = this->tail.load(std::memory_order_relaxed);
+            while (true)
+            {
+                cell = &this->slots[pos & mask];
+                const size_t seq = cell->sequence.load(std::memory_order_acquire);
+                const intptr_t diff = intptr_t(seq) - intptr_t(pos);
+                if (diff == 0)
+                {
+                    if (this->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (diff < 0)
+                {
+                    this->drops.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                else
+                {
+                    pos = this->tail.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->value = item;
+            cell->sequence.store(pos + 1, std::memory_order_release);
+            if (Policy == wait_policy::block)
+                this->signal.notify();
+            return true;
+        }
+
+        // consumer only; returns false if the ring is empty
+        bool try_pop(T &item)
+        {
+            const size_t pos = this->head.load(std::memory_order_relaxed);
+            slot &cell = this->slots[pos & mask];
+            if (cell.sequence.load(std::memory_order_acquire) != pos + 1)
+                return false;
+
+            item = std::move(cell.value);
+            cell.sequence.store(pos + Capacity, std::memory_order_release);
+            this->head.store(pos + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // must not be called on an empty queue
+        const T &front()
+        {
+            assert(!this->empty());
+            return this->slots[this->head.load(std::memory_order_relaxed) & mask].value;
+        }
+
+        // must not be called on an empty queue
+        T pop_front()
+        {
+            T item;
+            const bool popped = this->try_pop(item);
+            assert(popped);
+            (void)popped;
+            return item;
+        }
+
+        bool empty()
+        {
+            const size_t pos = this->head.load(std::memory_order_relaxed);
+            return this->slots[pos & mask].sequence.load(std::memory_order_acquire) != pos + 1;
+        }
+
+        // approximate while producers are pushing
+        size_t size()
+        {
+            const size_t t = this->tail.load(std::memory_order_relaxed);
+            const size_t h = this->head.load(std::memory_order_relaxed);
+            return t > h ? t - h : 0;
+        }
+
+        void clear()
+        {
+            T item;
+            while (this->try_pop(item))
+                ;
+        }
+
+        void wait()
+        {
+            if (Policy == wait_policy::block)
+            {
+                this->signal.wait([this]() { return !this->empty(); });
+                return;
+            }
+            while (this->empty())
+                std::this_thread::yield();
+        }
+
+        size_t capacity() const { return Capacity; }
+        uint64_t dropped() const { return this->drops.load(std::memory_order_relaxed); }
+
+    private:
+        static constexpr size_t mask = Capacity - 1;
+
+        struct alignas(cache_line_size) slot
+        {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        alignas(cache_line_size) std::atomic<size_t> head{0}; // consumer-owned
+        alignas(cache_line_size) std::atomic<size_t> tail{0}; // shared by producers
+        std::atomic<uint64_t> drops{0};
+
+        alignas(cache_line_size) wait_signal signal;
+        slot slots[Capacity];
+    };
+} // namespace net
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "net_common.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#endif
+
+namespace net
+{
+    // Best effort tuning of latency critical threads and sockets. Every helper
+    // returns false (and says why) when the platform or the permissions do not
+    // allow it, and the caller simply carries on without.
+    namespace realtime
+    {
+        // pins the calling thread to one cpu
+        inline bool pinCurrentThread(int cpu)
+        {
+#if defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            const int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            if (error != 0)
+            {
+                std::cerr << "[REALTIME] Cannot pin thread to cpu " << cpu << ": " << std::strerror(error) << "\n";
+                return false;
+            }
+            return true;
+#elif defined(_WIN32)
+            if (SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) == 0)
+            {
+                std::cerr << "[REALTIME] Cannot pin thread to cpu " << cpu << ".\n";
+                return false;
+            }
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        // SCHED_FIFO on Linux (needs CAP_SYS_NICE or an rtprio limit), time critical on Windows
+        inline bool raiseCurrentThreadPriority(int priority = 50)
+        {
+#if defined(__linux__)
+            sched_param param{};
+            param.sched_priority = std::min(priority, sched_get_priority_max(SCHED_FIFO));
+            const int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+            if (error != 0)
+            {
+                std::cerr << "[REALTIME] No SCHED_FIFO (" << std::strerror(error) << "), keeping the default policy.\n";
+                return false;
+            }
+            return true;
+#elif defined(_WIN32)
+            if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL))
+            {
+                std::cerr << "[REALTIME] Cannot raise thread priority, keeping the default one.\n";
+                return false;
+            }
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        // lets the kernel busy poll the device queue for up to usec on blocking reads of the socket
+        template <typename TSocket>
+        bool enableSocketBusyPoll(TSocket &socket, int usec)
+        {
+#if defined(__linux__) && defined(SO_BUSY_POLL)
+            if (setsockopt(socket.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) != 0)
+            {
+                // raising it above net.core.busy_poll needs CAP_NET_ADMIN; only say so once
+                static std::atomic<bool> reported{false};
+                if (!reported.exchange(true))
+                    std::cerr << "[REALTIME] No SO_BUSY_POLL (" << std::strerror(errno) << "), relying on the poll loop only.\n";
+                return false;
+            }
+            return true;
+#else
+            (void)socket;
+            (void)usec;
+            return false;
+#endif
+        }
+    } // namespace realtime
+} // namespace net
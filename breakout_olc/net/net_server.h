@@ -4,6 +4,13 @@
 #include "net_concurrent_queue.h"
 #include "net_message.h"
 #include "net_connection.h"
+#include "net_connection_table.h"
+#include "net_udp.h"
+#include "net_shm.h"
+#include "net_histogram.h"
+#include "net_realtime.h"
+#include "net_metrics.h"
+#include "net_metrics_http.h"
 
 namespace net
 {
@@ -11,41 +18,125 @@ namespace net
     class server_interface
     {
     public:
-        server_interface(uint16_t port) : port(port), acceptor(context, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port))
+        // ioThreads threads run the asio context; handlers of a connection never run concurrently
+        server_interface(uint16_t port, size_t ioThreads = 1)
+            : port(port), ioThreadCount(std::max<size_t>(ioThreads, 1)), acceptor(context, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port))
         {
+#ifdef SPSC_QUEUE_IMPLEMENTATION
+            if (this->ioThreadCount > 1)
+            {
+                std::cerr << "[SERVER] The spsc msgs queue only supports one asio thread.\n";
+                this->ioThreadCount = 1;
+            }
+#endif
         }
 
         virtual ~server_interface()
         {
             this->stop();
+            if (this->metricsEndpoint)
+                for (const char *name : sampledMetrics)
+                    metrics_registry::global().removeSampled(name);
         }
 
-        bool start()
+        // without own threads nothing runs the asio context: the owner must call poll()
+        // from its loop, which then does the network i/o and dispatches msgs inline
+        bool start(bool ownThreads = true)
         {
             try
             {
-                this->waitForClientConnectionAsync();
-                this->contextThread = std::thread([this]() { this->context.run(); });
+                if (this->udpEnabled)
+                {
+                    this->udp = std::make_unique<udp_receiver<T>>(
+                        this->context, this->port, this->msgsIn,
+                        [this](uint32_t id) { return this->findConnection(id); });
+                    if (this->busyPollCpu >= 0)
+                        this->udp->enableBusyPoll(this->socketBusyPollUsec);
+                    this->udp->start();
+                }
+#if defined(ASIO_HAS_CO_AWAIT)
+                if (this->receiveMode == receive_mode::coroutine)
+                    asio::co_spawn(this->context, this->acceptLoop(), asio::detached);
+                else
+#endif
+                    this->waitForClientConnectionAsync();
+                if (this->metricsPort != 0)
+                    this->startMetrics();
+                if (ownThreads && this->busyPollCpu >= 0)
+                    this->contextThreads.emplace_back([this]() { this->runBusyPoll(); });
+                for (size_t i = 0; ownThreads && this->busyPollCpu < 0 && i < this->ioThreadCount; ++i)
+                    this->contextThreads.emplace_back([this]() { this->context.run(); });
             }
             catch (const std::exception &e)
             {
                 std::cerr << "[SERVER] Exception: " << e.what() << '\n';
                 return false;
             }
-            std::cout << "[SERVER] Started at port " << this->port << ".\n";
+            if (ownThreads && this->busyPollCpu >= 0)
+                std::cout << "[SERVER] Started at port " << this->port << ", busy polling on cpu " << this->busyPollCpu << ".\n";
+            else if (ownThreads)
+                std::cout << "[SERVER] Started at port " << this->port << " with " << this->ioThreadCount << " asio thread(s).\n";
+            else
+                std::cout << "[SERVER] Started at port " << this->port << ", polled by its owner.\n";
             return true;
         }
 
         bool stop()
         {
             this->context.stop();
-            if (this->contextThread.joinable())
-                this->contextThread.join();
+            for (std::thread &thread : this->contextThreads)
+                if (thread.joinable())
+                    thread.join();
+            this->contextThreads.clear();
 
             std::cout << "[SERVER] Stopped.\n";
             return true;
         }
 
+        // applies to connections accepted from now on
+        void setReceiveMode(receive_mode mode) { this->receiveMode = mode; }
+
+        // also accept commands as datagrams on the same port (see udp_receiver); before start only
+        void setUdpEnabled(bool enabled) { this->udpEnabled = enabled; }
+
+        // pings every connection accepted from now on and closes the silent ones (see heartbeat_config)
+        void setHeartbeat(const heartbeat_config &config) { this->heartbeat = config; }
+
+        // legacy clients sending value mean the control code instead (see connection::setLegacySentinel)
+        void setLegacySentinel(const T &value, uint32_t code)
+        {
+            this->hasLegacySentinel = true;
+            this->legacySentinel = value;
+            this->legacySentinelCode = code;
+        }
+
+        // serves the process metrics at http://127.0.0.1:port/metrics from the asio context,
+        // along with the depth and drops of this server's queue; before start only, 0 turns it off
+        void setMetricsPort(uint16_t port) { this->metricsPort = port; }
+
+        // replaces the asio threads with one thread pinned to cpu, raised to SCHED_FIFO if
+        // permitted, that spins on poll() instead of sleeping in epoll; sockets also get
+        // SO_BUSY_POLL when permitted. Before start only, cpu < 0 turns it off
+        void setBusyPoll(int cpu, int socketBusyPollUsec = 50)
+        {
+            this->busyPollCpu = cpu;
+            this->socketBusyPollUsec = socketBusyPollUsec;
+        }
+
+        // time between two polls of the busy poll thread, i.e. how long it was away
+        const latency_histogram &pollGaps() const { return this->pollGapHistogram; }
+
+        // change between consecutive command inter-arrival times of a connection, at receive
+        const latency_histogram &arrivalJitter() const { return this->arrivalJitterHistogram; }
+
+        void dumpJitter(std::ostream &os) const
+        {
+            printHistogramHeader(os, "JITTER");
+            printHistogram(os, "JITTER", "arrival", this->arrivalJitterHistogram);
+            if (this->busyPollCpu >= 0)
+                printHistogram(os, "JITTER", "poll gap", this->pollGapHistogram);
+        }
+
         void sendMessage(std::shared_ptr<connection<T>> client, const message<T> &msg)
         {
             if (client && client->isConnected())
@@ -59,18 +150,42 @@ namespace net
             }
         }
 
+        // runs the ready asio handlers, then dispatches the msgs they queued, all on the calling thread
+        void poll(size_t maxMessages = -1)
+        {
+            if (this->context.stopped())
+                this->context.restart();
+            this->context.poll();
+            this->update(maxMessages, false);
+        }
+
         void update(size_t maxMessages = -1, bool wait = false)
         {
             if (wait)
                 this->msgsIn.wait();
 
+            // controls and Closed are drained before every msg, so that they overtake the
+            // commands queued ahead of them (a Closed drops its connection's last ones);
+            // each one left an empty Control in msgsIn, skipped
             size_t msgsCnt = 0;
-            while (msgsCnt < maxMessages && !this->msgsIn.empty())
+            uint64_t commandsCnt = 0;
+            while (msgsCnt < maxMessages)
             {
-                owned_message<T> msg = this->msgsIn.pop_front();
-                this->onMessage(msg.remote, msg.msg);
+                owned_message<T> msg;
+                while (this->controlsIn.try_pop(msg))
+                    this->dispatch(msg);
+                if (!this->msgsIn.try_pop(msg))
+                    break;
                 msgsCnt++;
+
+                if (msg.header.id == msgType::Control && msg.body.empty())
+                    continue;
+                if (msg.header.id == msgType::Command)
+                    commandsCnt++;
+                this->dispatch(msg);
             }
+            if (commandsCnt > 0)
+                this->metrics.commandsDispatched.add(commandsCnt);
         }
 
     protected:
@@ -79,6 +194,11 @@ namespace net
             return false;
         }
 
+        // called once the client has its id, right before it starts reading (on any asio thread)
+        virtual void onClientConnected(std::shared_ptr<connection<T>> client)
+        {
+        }
+
         virtual void onClientDisconnected(std::shared_ptr<connection<T>> client)
         {
         }
@@ -87,60 +207,246 @@ namespace net
         {
         }
 
+        // any non-command frame of the framed protocol (control, telemetry, ...)
+        virtual void onFrame(std::shared_ptr<connection<T>> client, const owned_message<T> &msg)
+        {
+        }
+
     protected:
-        concurrent_queue<owned_message<T>> msgsIn; // thread-safe incoming msgs queue
+        message_queue<T> msgsIn;                   // thread-safe incoming msgs queue
+        control_queue<T> controlsIn;               // Control frames, resume Hellos and Closed of all clients, dispatched first
         asio::io_context context;                  // for running asio stuff
-        std::thread contextThread;                 // required by the asio context
+        std::vector<std::thread> contextThreads;   // all running the asio context
 
-        std::shared_ptr<connection<T>> current_client;
+        connection_table<T> connections; // accepts and removals happen on different threads
 
         uint16_t port;
+        size_t ioThreadCount;
         asio::ip::tcp::acceptor acceptor;
         uint32_t idCounter = 10000;
+        receive_mode receiveMode = receive_mode::bulk;
+        bool udpEnabled = false;
+        heartbeat_config heartbeat;
+        bool hasLegacySentinel = false;
+        T legacySentinel{};
+        uint32_t legacySentinelCode = 0;
+        uint64_t receivedAt = 0; // receive time of the msg being dispatched (protocol::timestampNow clock)
+        uint64_t sentAt = 0;     // its send time mapped onto the same clock, 0 unless the remote clock is synced
+
+        int busyPollCpu = -1;
+        int socketBusyPollUsec = 50;
+        latency_histogram pollGapHistogram;       // busy poll thread only records
+        latency_histogram arrivalJitterHistogram; // update thread only records
+
+        struct arrival
+        {
+            uint64_t last = 0;     // receive time of the previous command
+            uint64_t interval = 0; // between the two previous commands
+        };
+        std::unordered_map<uint32_t, arrival> arrivals; // update thread only
+        std::unique_ptr<udp_receiver<T>> udp;
+        transport_metrics &metrics = transport_metrics::get();
+        uint16_t metricsPort = 0;
+        std::unique_ptr<metrics_endpoint> metricsEndpoint;
+        static constexpr const char *sampledMetrics[] = {"net_msgs_in_depth", "net_msgs_in_dropped_total", "net_connections_active"};
+#if defined(__linux__)
+        std::unordered_map<uint32_t, std::unique_ptr<shm_receiver<T>>> shmReceivers; // update thread only
+#endif
 
     protected:
+        // only one accept is pending at a time, so this handler never runs concurrently with itself
         void waitForClientConnectionAsync()
         {
             this->acceptor.async_accept(
                 [this](std::error_code ec, asio::ip::tcp::socket socket) {
                     if (!ec)
-                    {
-                        const asio::ip::tcp::endpoint newEndpoint = socket.remote_endpoint();
-
-                        std::shared_ptr<connection<T>> newConnection = std::make_shared<connection<T>>(
-                            connection<T>::owner::server,
-                            this->context,
-                            std::move(socket),
-                            this->msgsIn);
-
-                        if (this->onClientConnecting(newConnection))
-                        {
-                            this->current_client = std::move(newConnection);
-                            this->current_client->connectToThisClient(this->idCounter++);
-
-                            std::cout << "[SERVER] New connection " << newEndpoint
-                                      << " approved with id " << this->current_client->getId() << ".\n";
-                        }
-                        else
-                        {
-                            std::cout << "[SERVER] New connection " << newEndpoint << " denied.\n";
-                        }
-                    }
+                        this->acceptConnection(std::move(socket));
                     else
-                    {
                         std::cerr << "[SERVER] New connection error: " << ec.message() << "\n";
-                    }
 
                     this->waitForClientConnectionAsync();
                 });
         }
 
+#if defined(ASIO_HAS_CO_AWAIT)
+        // the accepts as one loop; a failing accept (out of descriptors, ...) is retried
+        // after a pause rather than at once, and stop() ends the loop with the context
+        asio::awaitable<void> acceptLoop()
+        {
+            asio::steady_timer backoff(this->context);
+            asio::error_code ec;
+            while (true)
+            {
+                asio::ip::tcp::socket socket = co_await this->acceptor.async_accept(asio::redirect_error(asio::use_awaitable, ec));
+                if (ec == asio::error::operation_aborted)
+                    co_return;
+                if (!ec)
+                {
+                    this->acceptConnection(std::move(socket));
+                    continue;
+                }
+
+                std::cerr << "[SERVER] New connection error: " << ec.message() << "\n";
+                backoff.expires_after(std::chrono::milliseconds(100));
+                co_await backoff.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+            }
+        }
+#endif
+
+        void dispatch(const owned_message<T> &msg)
+        {
+            // msgs still queued for a connection that was removed meanwhile are dropped
+            const std::shared_ptr<connection<T>> *remote = this->connections.peek(msg.remoteId);
+            if (!remote)
+                return;
+
+            this->receivedAt = msg.received;
+            this->sentAt = 0;
+            if (msg.header.timestamp != 0 && (*remote)->remoteClock().isSynced())
+                this->sentAt = (*remote)->remoteClock().toLocal(msg.header.timestamp);
+            if (msg.header.id == msgType::Command)
+            {
+                this->recordArrival(msg);
+                this->onMessage(*remote, msg.msg);
+            }
+            else if (msg.header.id == msgType::Closed)
+                this->onClientDisconnected(*remote);
+            else if (msg.header.id == msgType::ShmAttach)
+                this->attachSharedMemory(*remote, msg);
+            else
+                this->onFrame(*remote, msg);
+        }
+
+        void acceptConnection(asio::ip::tcp::socket socket)
+        {
+            // a peer that reset since the accept is skipped; throwing would end a coroutine acceptLoop
+            asio::error_code ec;
+            const asio::ip::tcp::endpoint newEndpoint = socket.remote_endpoint(ec);
+            if (ec)
+            {
+                std::cerr << "[SERVER] New connection lost before approval: " << ec.message() << "\n";
+                return;
+            }
+            if (this->busyPollCpu >= 0)
+                realtime::enableSocketBusyPoll(socket, this->socketBusyPollUsec);
+
+            std::shared_ptr<connection<T>> newConnection = std::make_shared<connection<T>>(
+                connection<T>::owner::server,
+                this->context,
+                std::move(socket),
+                this->msgsIn,
+                this->receiveMode);
+            newConnection->setControlQueue(&this->controlsIn);
+            if (this->hasLegacySentinel)
+                newConnection->setLegacySentinel(this->legacySentinel, this->legacySentinelCode);
+
+            if (!this->onClientConnecting(newConnection))
+            {
+                std::cout << "[SERVER] New connection " << newEndpoint << " denied.\n";
+                this->metrics.connectionsDenied.add();
+            }
+            else if (this->connections.insert(newConnection, this->idCounter) == 0)
+            {
+                std::cout << "[SERVER] New connection " << newEndpoint << " denied, too many connections.\n";
+                this->metrics.connectionsDenied.add();
+            }
+            else
+            {
+                this->onClientConnected(newConnection);
+                newConnection->connectToThisClient();
+                newConnection->startHeartbeat(this->heartbeat);
+                this->metrics.connectionsAccepted.add();
+
+                std::cout << "[SERVER] New connection " << newEndpoint
+                          << " approved with id " << newConnection->getId() << ".\n";
+            }
+        }
+
+        // levels this server already keeps are read when scraped
+        void startMetrics()
+        {
+            metrics_registry &registry = metrics_registry::global();
+            registry.sampled(sampledMetrics[0], "Messages waiting for the server thread.", metric_type::gauge,
+                             [this]() { return double(this->msgsIn.size()); });
+            registry.sampled(sampledMetrics[1], "Messages dropped on a full incoming queue.", metric_type::counter,
+                             [this]() { return double(this->msgsIn.dropped()); });
+            registry.sampled(sampledMetrics[2], "Connections open on the server.", metric_type::gauge,
+                             [this]() { return double(this->connections.size()); });
+            this->metricsEndpoint = std::make_unique<metrics_endpoint>(this->context, this->metricsPort);
+            this->metricsEndpoint->start();
+        }
+
+        void runBusyPoll()
+        {
+            realtime::pinCurrentThread(this->busyPollCpu);
+            realtime::raiseCurrentThreadPriority();
+
+            auto work = asio::make_work_guard(this->context);
+            uint64_t last = protocol::timestampNow();
+            while (!this->context.stopped())
+            {
+                this->context.poll();
+                const uint64_t now = protocol::timestampNow();
+                this->pollGapHistogram.record(now - last);
+                last = now;
+            }
+        }
+
+        void recordArrival(const owned_message<T> &msg)
+        {
+            if (msg.received == 0)
+                return;
+
+            arrival &previous = this->arrivals[msg.remoteId];
+            if (previous.last != 0 && msg.received >= previous.last)
+            {
+                const uint64_t interval = msg.received - previous.last;
+                if (previous.interval != 0)
+                    this->arrivalJitterHistogram.record(interval > previous.interval ? interval - previous.interval : previous.interval - interval);
+                previous.interval = interval;
+            }
+            previous.last = msg.received;
+        }
+
+        // any thread
+        std::shared_ptr<connection<T>> findConnection(uint32_t id)
+        {
+            return this->connections.find(id);
+        }
+
+        // a client on the same host asked to send its commands through a shm segment
+        void attachSharedMemory(std::shared_ptr<connection<T>> client, const owned_message<T> &msg)
+        {
+#if defined(SPSC_QUEUE_IMPLEMENTATION)
+            // the receiver thread would be a second producer of the single producer ring
+            std::cerr << "[SERVER] Client [" << client->getId() << "] shm segment refused, msgsIn is single producer.\n";
+#elif defined(__linux__)
+            // the segment is named by the client, only a local one can have created it
+            if (!client->remoteAddress().is_loopback())
+            {
+                std::cerr << "[SERVER] Client [" << client->getId() << "] shm segment refused, client is not local.\n";
+                return;
+            }
+            auto receiver = std::make_unique<shm_receiver<T>>(client->getId(), this->msgsIn);
+            if (receiver->attach(std::string(msg.body.begin(), msg.body.end())))
+            {
+                this->shmReceivers[client->getId()] = std::move(receiver);
+                std::cout << "[SERVER] Client [" << client->getId() << "] attached a shm segment.\n";
+            }
+#else
+            std::cerr << "[SERVER] Shared memory transport not supported on this platform.\n";
+#endif
+        }
+
+        // update thread only; msgs already queued for the client are dropped
         void removeConnection(std::shared_ptr<connection<T>> client)
         {
+#if defined(__linux__)
+            this->shmReceivers.erase(client->getId());
+#endif
+            this->arrivals.erase(client->getId());
             client->disconnect();
-            client.reset();
-            current_client.reset();
-            this->msgsIn.clear();
+            this->connections.erase(client->getId());
         }
     };
 } // namespace net
@@ -0,0 +1,312 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_connection.h"
+
+#if defined(__linux__)
+#include <climits>
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace net
+{
+    // Same-host command channel: a POSIX shared memory segment holding a
+    // single-producer/single-consumer ring of fixed size slots. The client
+    // creates the segment and tells the server its name with a ShmAttach frame
+    // over the TCP connection; the server maps it, unlinks the name and reads
+    // it on a dedicated thread, queueing Command msgs exactly as the TCP and
+    // UDP paths do. The reader spins briefly, then sleeps on a shared futex
+    // that the writer only wakes if the reader is actually asleep.
+    namespace shm
+    {
+        constexpr uint32_t magic = 0x42524B4F;  // "BRKO"
+        constexpr uint32_t version = 1;
+        constexpr uint32_t slotCount = 1024;    // power of two
+        constexpr size_t payloadSize = 48;      // bytes of T per slot
+        constexpr char namePrefix[] = "/breakout_olc.";
+
+        struct slot
+        {
+            uint32_t sequence;
+            uint32_t size;
+            uint64_t timestamp;
+            uint8_t payload[payloadSize];
+        };
+        static_assert(sizeof(slot) == 64, "One slot per cache line.");
+
+        struct alignas(cache_line_size) layout
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t capacity;
+            uint32_t slotSize;
+
+            alignas(cache_line_size) std::atomic<uint32_t> head; // reader
+            alignas(cache_line_size) std::atomic<uint32_t> tail; // writer
+            std::atomic<uint32_t> sleeping;                      // futex word, 1 while the reader sleeps
+            std::atomic<uint32_t> closed;                        // either side is gone
+
+            alignas(cache_line_size) slot slots[slotCount];
+        };
+        static_assert(std::atomic<uint32_t>::is_always_lock_free, "Shared atomics must be lock free.");
+
+        // only names made by shm_sender are accepted, so a remote cannot have us map anything else
+        inline bool validName(const std::string &name)
+        {
+            const size_t prefixLength = sizeof(namePrefix) - 1;
+            return name.size() > prefixLength && name.size() < 255 && name.compare(0, prefixLength, namePrefix) == 0 &&
+                   name.find('/', 1) == std::string::npos;
+        }
+
+#if defined(__linux__)
+        // not FUTEX_*_PRIVATE: the word is shared between processes
+        inline void futexWait(std::atomic<uint32_t> &word, uint32_t expected)
+        {
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected, nullptr, nullptr, 0);
+        }
+
+        inline void futexWake(std::atomic<uint32_t> &word)
+        {
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+        }
+#endif
+    } // namespace shm
+
+#if defined(__linux__)
+    // Server end of a segment, owned by server_interface for the lifetime of the connection.
+    template <typename T>
+    class shm_receiver
+    {
+        static_assert(sizeof(T) <= shm::payloadSize, "T does not fit in a shm slot.");
+
+    public:
+        shm_receiver(uint32_t remoteId, message_queue<T> &queue) : remoteId(remoteId), msgsIn(queue)
+        {
+        }
+        shm_receiver(const shm_receiver<T> &) = delete;
+
+        ~shm_receiver()
+        {
+            this->stop();
+            if (this->ring)
+                munmap(this->ring, sizeof(shm::layout));
+        }
+
+        bool attach(const std::string &name)
+        {
+            if (!shm::validName(name))
+            {
+                std::cerr << "[" << this->remoteId << "] Invalid shm segment name.\n";
+                return false;
+            }
+
+            const int fd = shm_open(name.c_str(), O_RDWR, 0);
+            if (fd < 0)
+            {
+                std::cerr << "[" << this->remoteId << "] Cannot open shm segment " << name << ": " << std::strerror(errno) << "\n";
+                return false;
+            }
+            struct stat info;
+            void *mapped = MAP_FAILED;
+            if (fstat(fd, &info) == 0 && size_t(info.st_size) == sizeof(shm::layout))
+                mapped = mmap(nullptr, sizeof(shm::layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            shm_unlink(name.c_str()); // the mapping keeps it alive, nothing is left behind when both ends are gone
+            if (mapped == MAP_FAILED)
+            {
+                std::cerr << "[" << this->remoteId << "] Cannot map shm segment " << name << ".\n";
+                return false;
+            }
+
+            this->ring = static_cast<shm::layout *>(mapped);
+            if (this->ring->magic != shm::magic || this->ring->version != shm::version ||
+                this->ring->capacity != shm::slotCount || this->ring->slotSize != sizeof(shm::slot))
+            {
+                std::cerr << "[" << this->remoteId << "] Incompatible shm segment " << name << ".\n";
+                return false;
+            }
+
+            this->reader = std::thread(&shm_receiver<T>::read, this);
+            return true;
+        }
+
+        void stop()
+        {
+            if (!this->reader.joinable())
+                return;
+            this->stopping = true;
+            this->ring->closed.store(1, std::memory_order_relaxed);
+            this->ring->sleeping.store(0, std::memory_order_relaxed);
+            shm::futexWake(this->ring->sleeping);
+            this->reader.join();
+        }
+
+    private:
+        static constexpr uint32_t spinCount = 4000; // roughly a few microseconds before sleeping
+
+        uint32_t remoteId;
+        message_queue<T> &msgsIn;
+        shm::layout *ring = nullptr;
+        std::thread reader;
+        std::atomic<bool> stopping{false};
+
+        bool available() const
+        {
+            return this->ring->tail.load(std::memory_order_acquire) != this->ring->head.load(std::memory_order_relaxed);
+        }
+
+        void read()
+        {
+            while (!this->stopping)
+            {
+                if (!this->waitAvailable())
+                    continue;
+
+                uint32_t head = this->ring->head.load(std::memory_order_relaxed);
+                const uint32_t tail = this->ring->tail.load(std::memory_order_acquire);
+                const uint64_t now = protocol::timestampNow();
+                for (; head != tail; ++head)
+                {
+                    const shm::slot &cell = this->ring->slots[head & (shm::slotCount - 1)];
+                    if (cell.size != sizeof(T))
+                        continue;
+
+                    owned_message<T> owned_msg;
+                    owned_msg.header.id = msgType::Command;
+                    owned_msg.header.channel = msgChannel::command;
+                    owned_msg.header.size = sizeof(T);
+                    owned_msg.header.sequence = cell.sequence;
+                    owned_msg.header.timestamp = cell.timestamp;
+                    std::memcpy(&owned_msg.msg, cell.payload, sizeof(T)); // same host, native byte order
+                    owned_msg.remoteId = this->remoteId;
+                    owned_msg.received = now;
+                    this->msgsIn.push_back(owned_msg); // dropped if full, as tcp commands
+                }
+                this->ring->head.store(head, std::memory_order_release);
+            }
+        }
+
+        // spins, then sleeps until the writer publishes or stop is called
+        bool waitAvailable()
+        {
+            for (uint32_t i = 0; i < spinCount; ++i)
+                if (this->available())
+                    return true;
+
+            this->ring->sleeping.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (this->available() || this->stopping)
+            {
+                this->ring->sleeping.store(0, std::memory_order_relaxed);
+                return !this->stopping;
+            }
+            shm::futexWait(this->ring->sleeping, 1);
+            this->ring->sleeping.store(0, std::memory_order_relaxed);
+            return this->available();
+        }
+    };
+
+    // Client end: creates the segment and publishes command samples into it.
+    // send is wait-free and meant for one thread; a full ring drops the sample.
+    template <typename T>
+    class shm_sender
+    {
+        static_assert(sizeof(T) <= shm::payloadSize, "T does not fit in a shm slot.");
+
+    public:
+        shm_sender() = default;
+        shm_sender(const shm_sender<T> &) = delete;
+
+        ~shm_sender()
+        {
+            if (this->ring)
+            {
+                this->ring->closed.store(1, std::memory_order_relaxed);
+                munmap(this->ring, sizeof(shm::layout));
+            }
+            if (!this->segmentName.empty())
+                shm_unlink(this->segmentName.c_str()); // in case the server never attached
+        }
+
+        // the name is unique per process and connection id
+        bool create(uint32_t id)
+        {
+            this->segmentName = std::string(shm::namePrefix) + std::to_string(getpid()) + "." + std::to_string(id);
+            const int fd = shm_open(this->segmentName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (fd < 0)
+            {
+                std::cerr << "[CLIENT] Cannot create shm segment " << this->segmentName << ": " << std::strerror(errno) << "\n";
+                this->segmentName.clear();
+                return false;
+            }
+            void *mapped = MAP_FAILED;
+            if (ftruncate(fd, sizeof(shm::layout)) == 0)
+                mapped = mmap(nullptr, sizeof(shm::layout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (mapped == MAP_FAILED)
+            {
+                std::cerr << "[CLIENT] Cannot map shm segment " << this->segmentName << ".\n";
+                return false;
+            }
+
+            // a fresh segment is zero filled, which is a valid empty ring
+            this->ring = static_cast<shm::layout *>(mapped);
+            this->ring->capacity = shm::slotCount;
+            this->ring->slotSize = sizeof(shm::slot);
+            this->ring->version = shm::version;
+            this->ring->magic = shm::magic;
+            return true;
+        }
+
+        // the ShmAttach frame to send over the TCP connection once create succeeded
+        message<T> attachMessage() const
+        {
+            message<T> msg;
+            msg.header.id = msgType::ShmAttach;
+            msg.header.channel = msgChannel::system;
+            msg.body.assign(this->segmentName.begin(), this->segmentName.end());
+            msg.header.size = msg.size();
+            return msg;
+        }
+
+        bool isOpen() const { return this->ring && this->ring->closed.load(std::memory_order_relaxed) == 0; }
+
+        bool send(const T &value)
+        {
+            if (!this->isOpen())
+                return false;
+
+            const uint32_t tail = this->ring->tail.load(std::memory_order_relaxed);
+            if (tail - this->ring->head.load(std::memory_order_acquire) >= shm::slotCount)
+                return false;
+
+            shm::slot &cell = this->ring->slots[tail & (shm::slotCount - 1)];
+            cell.sequence = ++this->sequence;
+            cell.size = sizeof(T);
+            cell.timestamp = protocol::timestampNow();
+            std::memcpy(cell.payload, &value, sizeof(T));
+            this->ring->tail.store(tail + 1, std::memory_order_release);
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (this->ring->sleeping.load(std::memory_order_relaxed) != 0)
+            {
+                this->ring->sleeping.store(0, std::memory_order_relaxed);
+                shm::futexWake(this->ring->sleeping);
+            }
+            return true;
+        }
+
+    private:
+        shm::layout *ring = nullptr;
+        std::string segmentName;
+        uint32_t sequence = 0;
+    };
+#endif
+} // namespace net
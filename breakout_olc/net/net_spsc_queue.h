@@ -0,0 +1,132 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_wait_signal.h"
+
+namespace net
+{
+    constexpr size_t cache_line_size = 64;
+
+    enum class wait_policy
+    {
+        spin, // wait() spins with yields, producers never signal
+        block // wait() sleeps on a wait_signal (futex on Linux)
+    };
+
+    // Bounded, wait-free single-producer/single-consumer ring buffer.
+    // Exposes the subset of concurrent_queue used on the inbound path, so it can
+    // be dropped in as msgsIn: push_back is for the producer only, everything
+    // else (front, pop_front, clear, wait) is for the consumer only.
+    // Unlike concurrent_queue it never grows: when full, push_back drops the
+    // new item and counts it in dropped().
+    template <typename T, size_t Capacity = 1024, wait_policy Policy = wait_policy::block>
+    class spsc_queue
+    {
+        static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two.");
+
+    public:
+        spsc_queue() = default;
+        spsc_queue(const spsc_queue<T, Capacity, Policy> &) = delete;
+
+    public:
+        // returns false (and drops the item) if the ring is full
+        bool push_back(const T &item)
+        {
+            const size_t t = this->tail.load(std::memory_order_relaxed);
+            if (t - this->cachedHead == Capacity)
+            {
+                this->cachedHead = this->head.load(std::memory_order_acquire);
+                if (t - this->cachedHead == Capacity)
+                {
+                    this->drops.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+
+            this->slots[t & mask] = item;
+            this->tail.store(t + 1, std::memory_order_release);
+            if (Policy == wait_policy::block)
+                this->signal.notify();
+            return true;
+        }
+
+        // returns false if the ring is empty
+        bool try_pop(T &item)
+        {
+            const size_t h = this->head.load(std::memory_order_relaxed);
+            if (h == this->cachedTail)
+            {
+                this->cachedTail = this->tail.load(std::memory_order_acquire);
+                if (h == this->cachedTail)
+                    return false;
+            }
+
+            item = std::move(this->slots[h & mask]);
+            this->head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        // must not be called on an empty queue
+        const T &front()
+        {
+            assert(!this->empty());
+            return this->slots[this->head.load(std::memory_order_relaxed) & mask];
+        }
+
+        // must not be called on an empty queue
+        T pop_front()
+        {
+            T item;
+            const bool popped = this->try_pop(item);
+            assert(popped);
+            (void)popped;
+            return item;
+        }
+
+        bool empty()
+        {
+            return this->head.load(std::memory_order_relaxed) == this->tail.load(std::memory_order_acquire);
+        }
+
+        size_t size()
+        {
+            return this->tail.load(std::memory_order_acquire) - this->head.load(std::memory_order_relaxed);
+        }
+
+        void clear()
+        {
+            T item;
+            while (this->try_pop(item))
+                ;
+        }
+
+        void wait()
+        {
+            if (Policy == wait_policy::block)
+            {
+                this->signal.wait([this]() { return !this->empty(); });
+                return;
+            }
+            while (this->empty())
+                std::this_thread::yield();
+        }
+
+        size_t capacity() const { return Capacity; }
+        uint64_t dropped() const { return this->drops.load(std::memory_order_relaxed); }
+
+    private:
+        static constexpr size_t mask = Capacity - 1;
+
+        // consumer-owned line
+        alignas(cache_line_size) std::atomic<size_t> head{0};
+        size_t cachedTail = 0;
+
+        // producer-owned line
+        alignas(cache_line_size) std::atomic<size_t> tail{0};
+        size_t cachedHead = 0;
+        std::atomic<uint64_t> drops{0};
+
+        alignas(cache_line_size) wait_signal signal;
+        alignas(cache_line_size) T slots[Capacity];
+    };
+} // namespace net
@@ -0,0 +1,248 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_connection.h"
+#include "net_realtime.h"
+
+#if defined(__linux__)
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+namespace net
+{
+    // Datagram side channel for latest-wins command samples. Each datagram is
+    //   connection id (u32) | message_header | one T
+    // where the id is the one the server assigned over TCP (ServerAccept), and
+    // only datagrams from the address of that TCP connection are accepted. The
+    // header sequence is per datagram stream: anything not newer than the last
+    // accepted sample of the connection is stale and dropped, so a lost or
+    // reordered datagram never holds back the ones behind it.
+    namespace datagram
+    {
+        constexpr size_t prefixSize = 4;
+        constexpr size_t maxSize = prefixSize + protocol::headerSize + protocol::maxPayloadSize;
+    } // namespace datagram
+
+    // Server end: receives on the server port and queues Command msgs exactly as
+    // the TCP connections do. At most one receive is pending at a time, so its
+    // handlers never run concurrently, whatever the number of asio threads.
+    template <typename T>
+    class udp_receiver
+    {
+    public:
+        typedef std::function<std::shared_ptr<connection<T>>(uint32_t)> connection_lookup;
+
+        udp_receiver(asio::io_context &context, uint16_t port, message_queue<T> &queue, connection_lookup lookup)
+            : socket(context, asio::ip::udp::endpoint(asio::ip::udp::v4(), port)), msgsIn(queue), findConnection(std::move(lookup))
+        {
+        }
+        udp_receiver(const udp_receiver<T> &) = delete;
+
+        void start()
+        {
+            this->socket.non_blocking(true);
+            this->receiveAsync();
+        }
+
+        void enableBusyPoll(int usec)
+        {
+            realtime::enableSocketBusyPoll(this->socket, usec);
+        }
+
+        uint64_t accepted() const { return this->acceptedCount.load(std::memory_order_relaxed); }
+        uint64_t stale() const { return this->staleCount.load(std::memory_order_relaxed); }
+        uint64_t rejected() const { return this->rejectedCount.load(std::memory_order_relaxed); }
+
+    private:
+        struct peer
+        {
+            std::weak_ptr<connection<T>> remote; // only checked for expiry, never locked per datagram
+            asio::ip::address address;
+            uint32_t lastSequence = 0;
+        };
+
+        asio::ip::udp::socket socket;
+        message_queue<T> &msgsIn;
+        connection_lookup findConnection;
+        std::unordered_map<uint32_t, peer> peers; // receive handlers only
+
+        std::atomic<uint64_t> acceptedCount{0};
+        std::atomic<uint64_t> staleCount{0};
+        std::atomic<uint64_t> rejectedCount{0};
+
+#if defined(__linux__)
+        // drains up to batchSize datagrams per recvmmsg call once the socket is readable
+        static constexpr size_t batchSize = 32;
+        uint8_t buffers[batchSize][datagram::maxSize];
+        iovec vectors[batchSize];
+        sockaddr_in senders[batchSize];
+        mmsghdr headers[batchSize];
+
+        void receiveAsync()
+        {
+            this->socket.async_wait(asio::ip::udp::socket::wait_read, [this](std::error_code ec) {
+                if (ec)
+                {
+                    if (ec != asio::error::operation_aborted)
+                        std::cerr << "[UDP] Receive failed: " << ec.message() << "\n";
+                    return;
+                }
+                this->receiveBatches();
+                this->receiveAsync();
+            });
+        }
+
+        void receiveBatches()
+        {
+            while (true)
+            {
+                for (size_t i = 0; i < batchSize; ++i)
+                {
+                    this->vectors[i].iov_base = this->buffers[i];
+                    this->vectors[i].iov_len = datagram::maxSize;
+                    std::memset(&this->headers[i], 0, sizeof(mmsghdr));
+                    this->headers[i].msg_hdr.msg_iov = &this->vectors[i];
+                    this->headers[i].msg_hdr.msg_iovlen = 1;
+                    this->headers[i].msg_hdr.msg_name = &this->senders[i];
+                    this->headers[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+                }
+
+                const int received = recvmmsg(this->socket.native_handle(), this->headers, batchSize, MSG_DONTWAIT, nullptr);
+                if (received <= 0)
+                    return;
+
+                for (int i = 0; i < received; ++i)
+                {
+                    const asio::ip::address_v4 from(ntohl(this->senders[i].sin_addr.s_addr));
+                    this->onDatagram(this->buffers[i], this->headers[i].msg_len, from);
+                }
+                if (size_t(received) < batchSize)
+                    return;
+            }
+        }
+#else
+        uint8_t buffer[datagram::maxSize];
+        asio::ip::udp::endpoint sender;
+
+        void receiveAsync()
+        {
+            this->socket.async_receive_from(
+                asio::buffer(this->buffer), this->sender,
+                [this](std::error_code ec, std::size_t length) {
+                    if (ec == asio::error::operation_aborted)
+                        return;
+                    if (!ec)
+                        this->onDatagram(this->buffer, length, this->sender.address());
+                    this->receiveAsync();
+                });
+        }
+#endif
+
+        void onDatagram(const uint8_t *data, size_t length, const asio::ip::address &from)
+        {
+            if (length < datagram::prefixSize + protocol::headerSize + wire_codec<T>::size)
+            {
+                this->rejectedCount.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            const uint32_t id = wire::getU32(data);
+            const message_header<T> header = message_header<T>::decode(data + datagram::prefixSize);
+            if (header.id != msgType::Command || header.size != wire_codec<T>::size)
+            {
+                this->rejectedCount.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            peer *sender = this->findPeer(id, from);
+            if (!sender)
+            {
+                this->rejectedCount.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            // serial number arithmetic, so the sequence may wrap around
+            if (sender->lastSequence != 0 && int32_t(header.sequence - sender->lastSequence) <= 0)
+            {
+                this->staleCount.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            sender->lastSequence = header.sequence;
+
+            owned_message<T> owned_msg;
+            owned_msg.header = header;
+            owned_msg.header.channel = msgChannel::command;
+            owned_msg.msg = wire_codec<T>::decode(data + datagram::prefixSize + protocol::headerSize);
+            owned_msg.remoteId = id;
+            owned_msg.received = protocol::timestampNow();
+            this->msgsIn.push_back(owned_msg); // dropped if full, as tcp commands
+            this->acceptedCount.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // the peer of a live connection with that id and address, looked up once per connection
+        peer *findPeer(uint32_t id, const asio::ip::address &from)
+        {
+            auto it = this->peers.find(id);
+            if (it != this->peers.end())
+            {
+                if (!it->second.remote.expired())
+                    return it->second.address == from ? &it->second : nullptr;
+                this->peers.erase(it);
+            }
+
+            const std::shared_ptr<connection<T>> remote = this->findConnection(id);
+            if (!remote || !remote->isConnected() || remote->remoteAddress() != from)
+                return nullptr;
+
+            peer &sender = this->peers[id];
+            sender.remote = remote;
+            sender.address = from;
+            return &sender;
+        }
+    };
+
+    // Client end: sends command samples to a udp_receiver, once the TCP
+    // connection told us our id. send is synchronous and meant for one thread.
+    template <typename T>
+    class udp_sender
+    {
+    public:
+        udp_sender(asio::io_context &context) : socket(context)
+        {
+        }
+
+        void open(const asio::ip::udp::endpoint &server, uint32_t id)
+        {
+            this->socket.connect(server);
+            this->id = id;
+        }
+
+        bool isOpen() const { return this->socket.is_open(); }
+
+        bool send(const T &value)
+        {
+            message_header<T> header;
+            header.id = msgType::Command;
+            header.channel = msgChannel::command;
+            header.size = wire_codec<T>::size;
+            header.sequence = ++this->sequence;
+            header.timestamp = protocol::timestampNow();
+
+            uint8_t data[datagram::prefixSize + protocol::headerSize + wire_codec<T>::size];
+            wire::putU32(data, this->id);
+            header.encode(data + datagram::prefixSize);
+            wire_codec<T>::encode(data + datagram::prefixSize + protocol::headerSize, value);
+
+            asio::error_code ec;
+            this->socket.send(asio::buffer(data), 0, ec);
+            return !ec;
+        }
+
+    private:
+        asio::ip::udp::socket socket;
+        uint32_t id = 0;
+        uint32_t sequence = 0; // never 0 on the wire, the receiver uses 0 as "nothing yet"
+    };
+} // namespace net
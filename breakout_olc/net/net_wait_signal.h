@@ -0,0 +1,86 @@
+#pragma once
+
+#include "net_common.h"
+
+#if defined(__linux__)
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace net
+{
+    // Lets a single consumer sleep until a producer publishes something.
+    // Producers only pay for a fence and a load unless the consumer is
+    // actually asleep, so the fast path never touches a mutex or the kernel.
+    // On Linux the sleep is a futex on the flag word; elsewhere it falls back
+    // to a condition variable that is only locked while someone is waiting.
+    class wait_signal
+    {
+    public:
+        wait_signal() = default;
+        wait_signal(const wait_signal &) = delete;
+
+    public:
+        // blocks until ready() returns true; ready() must read the producer's
+        // index with (at least) acquire semantics
+        template <typename TPred>
+        void wait(TPred ready)
+        {
+            while (!ready())
+            {
+                this->sleeping.store(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (ready())
+                {
+                    this->sleeping.store(0, std::memory_order_relaxed);
+                    return;
+                }
+                this->block();
+            }
+        }
+
+        // to be called by the producer after publishing
+        void notify()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (this->sleeping.load(std::memory_order_relaxed) != 0)
+                this->wake();
+        }
+
+    private:
+        std::atomic<uint32_t> sleeping{0};
+
+#if defined(__linux__)
+        void block()
+        {
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(&this->sleeping), FUTEX_WAIT_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+
+        void wake()
+        {
+            this->sleeping.store(0, std::memory_order_relaxed);
+            syscall(SYS_futex, reinterpret_cast<uint32_t *>(&this->sleeping), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+        }
+#else
+        std::mutex mtx;
+        std::condition_variable cv;
+
+        void block()
+        {
+            std::unique_lock<std::mutex> ul(this->mtx);
+            this->cv.wait(ul, [this]() { return this->sleeping.load(std::memory_order_relaxed) == 0; });
+        }
+
+        void wake()
+        {
+            {
+                const std::lock_guard<std::mutex> lock(this->mtx);
+                this->sleeping.store(0, std::memory_order_relaxed);
+            }
+            this->cv.notify_one();
+        }
+#endif
+    };
+} // namespace net
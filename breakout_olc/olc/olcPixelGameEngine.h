@@ -1074,6 +1074,8 @@ namespace olc
 		virtual void OnAfterUserCreate();
 		virtual void OnBeforeUserUpdate(float &fElapsedTime);
 		virtual void OnAfterUserUpdate(float fElapsedTime);
+		virtual void OnBeforeDisplayFrame(); // layers uploaded, frame about to be presented
+		virtual void OnAfterDisplayFrame();
 
 	protected:
 		static PixelGameEngine* pge;
@@ -3117,7 +3119,9 @@ namespace olc
 		}
 
 		// Present Graphics to screen
+		for (auto& ext : vExtensions) ext->OnBeforeDisplayFrame();
 		renderer->DisplayFrame();
+		for (auto& ext : vExtensions) ext->OnAfterDisplayFrame();
 
 		// Update Title Bar
 		fFrameTimer += fElapsedTime;
@@ -3196,6 +3200,8 @@ namespace olc
 	void PGEX::OnAfterUserCreate()	{}
 	void PGEX::OnBeforeUserUpdate(float& fElapsedTime) {}
 	void PGEX::OnAfterUserUpdate(float fElapsedTime) {}
+	void PGEX::OnBeforeDisplayFrame() {}
+	void PGEX::OnAfterDisplayFrame() {}
 
 	// Need a couple of statics as these are singleton instances
 	// read from multiple locations
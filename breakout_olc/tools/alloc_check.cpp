@@ -0,0 +1,214 @@
+// Checks that the steady-state receive path performs no heap allocation: a
+// client streams commands through a loopback connection to a server_interface
+// whose update thread dispatches them; once warmed up, every operator new of
+// the process is counted while N more commands go through. Exits with 1 if
+// any was, so it can gate a build.
+//
+// With several asio threads, asio itself now and then allocates when a strand
+// hands its queued handlers over to another thread: that goes through asio's
+// per-thread recycling cache, which misses when its blocks were freed on the
+// other thread. The handlers of net/ never allocate; gate with one thread.
+//
+// g++ -std=c++17 -O2 tools/alloc_check.cpp -o alloc_check -pthread -lrt
+// MinGW: the "g++ build alloc_check" task of .vscode/tasks.json (-lws2_32 -lwsock32 -lbcrypt)
+// ./alloc_check [--port=PORT] [--commands=N] [--threads=N] [--framed] [--exact]
+
+#include <new>
+
+#include "../net/net.h"
+
+typedef float message_t;
+typedef std::chrono::steady_clock check_clock;
+
+// allocations counted while armed, by any thread
+static std::atomic<bool> counting{false};
+static std::atomic<uint64_t> allocations{0};
+
+static void *allocate(std::size_t size)
+{
+    if (counting.load(std::memory_order_relaxed))
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+static void *allocateAligned(std::size_t size, std::align_val_t alignment)
+{
+    if (counting.load(std::memory_order_relaxed))
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    const std::size_t align = std::max(std::size_t(alignment), sizeof(void *));
+#if defined(_WIN32)
+    if (void *p = _aligned_malloc(size ? size : 1, align))
+        return p;
+    throw std::bad_alloc();
+#else
+    void *p = nullptr;
+    if (posix_memalign(&p, align, size ? size : 1) != 0)
+        throw std::bad_alloc();
+    return p;
+#endif
+}
+
+// _aligned_malloc blocks must go back to _aligned_free
+static void freeAligned(void *p) noexcept
+{
+#if defined(_WIN32)
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void *operator new(std::size_t size) { return allocate(size); }
+void *operator new[](std::size_t size) { return allocate(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return std::malloc(size ? size : 1); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return std::malloc(size ? size : 1); }
+void *operator new(std::size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+void *operator new[](std::size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { freeAligned(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { freeAligned(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { freeAligned(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { freeAligned(p); }
+
+// counts the commands it dispatches
+class check_server : public net::server_interface<message_t>
+{
+public:
+    check_server(uint16_t port, size_t ioThreads) : net::server_interface<message_t>(port, ioThreads)
+    {
+    }
+
+    std::atomic<uint64_t> commands{0};
+
+protected:
+    virtual bool onClientConnecting(std::shared_ptr<net::connection<message_t>> client)
+    {
+        return true;
+    }
+
+    virtual void onClientDisconnected(std::shared_ptr<net::connection<message_t>> client)
+    {
+        this->removeConnection(client);
+    }
+
+    virtual void onMessage(std::shared_ptr<net::connection<message_t>> client, message_t msg)
+    {
+        this->commands.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+// value of an optional "--name=value" argument, or fallback if not given
+std::string getOption(int argc, char *argv[], const std::string &name, const std::string &fallback)
+{
+    const std::string prefix = "--" + name + "=";
+    for (int i = 1; i < argc; ++i)
+        if (std::string(argv[i]).compare(0, prefix.size(), prefix) == 0)
+            return std::string(argv[i]).substr(prefix.size());
+    return fallback;
+}
+
+bool hasFlag(int argc, char *argv[], const std::string &name)
+{
+    for (int i = 1; i < argc; ++i)
+        if (argv[i] == "--" + name)
+            return true;
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint16_t port = uint16_t(std::stoul(getOption(argc, argv, "port", "60297")));
+    const uint64_t commands = std::stoull(getOption(argc, argv, "commands", "10000"));
+    const size_t threads = std::stoul(getOption(argc, argv, "threads", "1"));
+    const bool framed = hasFlag(argc, argv, "framed");
+
+    check_server server(port, threads);
+    server.setReceiveMode(hasFlag(argc, argv, "exact") ? net::receive_mode::exact : net::receive_mode::bulk);
+    server.start();
+    std::atomic<bool> running{true};
+    std::thread updater([&]() {
+        while (running)
+            server.update(-1, true);
+    });
+
+    asio::io_context context;
+    asio::ip::tcp::socket socket(context);
+    socket.connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port));
+
+    // chunks of a few frames, so that the stream looks like a robot's rather than one burst
+    const size_t batch = 16;
+    const size_t frameSize = framed ? net::protocol::headerSize + sizeof(message_t) : sizeof(message_t);
+    std::vector<uint8_t> chunk(frameSize * batch);
+    if (framed)
+    {
+        uint8_t hello[sizeof(net::protocol::magic) + net::protocol::headerSize + 4];
+        std::memcpy(hello, net::protocol::magic, sizeof(net::protocol::magic));
+        net::message_header<message_t> header;
+        header.id = net::msgType::Hello;
+        header.size = 4;
+        header.encode(hello + sizeof(net::protocol::magic));
+        net::wire::putU32(hello + sizeof(net::protocol::magic) + net::protocol::headerSize, net::protocol::version);
+        asio::write(socket, asio::buffer(hello));
+    }
+    for (size_t i = 0; i < batch; ++i)
+    {
+        uint8_t *frame = chunk.data() + i * frameSize;
+        if (framed)
+        {
+            net::message_header<message_t> header;
+            header.id = net::msgType::Command;
+            header.channel = net::msgChannel::command;
+            header.size = sizeof(message_t);
+            header.encode(frame);
+            frame += net::protocol::headerSize;
+        }
+        net::wire_codec<message_t>::encode(frame, 0.5f);
+    }
+
+    // sends count commands, each chunk once the previous one was dispatched; false on a stall
+    uint64_t sent = 0;
+    const auto stream = [&](uint64_t count) {
+        for (uint64_t c = 0; c < count / batch; ++c)
+        {
+            asio::write(socket, asio::buffer(chunk));
+            sent += batch;
+            const check_clock::time_point deadline = check_clock::now() + std::chrono::seconds(2);
+            while (server.commands.load(std::memory_order_relaxed) < sent)
+            {
+                if (check_clock::now() > deadline)
+                    return false;
+                std::this_thread::yield();
+            }
+        }
+        return true;
+    };
+
+    // connection setup, the first reads and the framed handshake may allocate
+    bool streamed = stream(1024);
+    if (streamed)
+    {
+        counting = true;
+        streamed = stream(commands);
+        counting = false;
+    }
+
+    running = false;
+    asio::write(socket, asio::buffer(chunk.data(), frameSize)); // wakes the update thread
+    updater.join();
+    server.stop();
+
+    if (!streamed)
+    {
+        std::cerr << "FAIL: the server stalled after " << server.commands.load() << " of " << sent << " commands\n";
+        return 1;
+    }
+    std::cout << (allocations == 0 ? "OK: " : "FAIL: ") << allocations.load() << " allocation(s) over "
+              << commands / batch * batch << " commands (" << threads << " asio thread(s), "
+              << (framed ? "framed" : "legacy") << ", " << (hasFlag(argc, argv, "exact") ? "exact" : "bulk") << ")\n";
+    return allocations == 0 ? 0 : 1;
+}
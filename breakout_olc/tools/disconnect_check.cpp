@@ -0,0 +1,149 @@
+// Checks that the server hears of every disconnection, whatever closed it:
+// - flood: a legacy client fills msgsIn while the server thread is not
+//   dispatching, then hangs up;
+// - protocol: a framed client sends a frame over protocol::maxPayloadSize, so
+//   the server closes the socket itself.
+// Either way the server must dispatch the disconnection and free the
+// connection. Exits with 1 if it does not, so it can gate a build.
+//
+// g++ -std=c++17 -O2 tools/disconnect_check.cpp -o disconnect_check -pthread -lrt
+// MinGW: the "g++ build disconnect_check" task of .vscode/tasks.json (-lws2_32 -lwsock32 -lbcrypt)
+// ./disconnect_check [--port=PORT] [--commands=N]
+
+#include "../net/net.h"
+
+typedef float message_t;
+typedef std::chrono::steady_clock check_clock;
+
+class check_server : public net::server_interface<message_t>
+{
+public:
+    explicit check_server(uint16_t port) : net::server_interface<message_t>(port)
+    {
+    }
+
+    std::atomic<uint64_t> disconnections{0};
+
+    uint64_t queued() { return this->msgsIn.size(); }
+    uint64_t dropped() { return this->msgsIn.dropped(); }
+    size_t connectionCount() { return this->connections.size(); }
+
+protected:
+    virtual bool onClientConnecting(std::shared_ptr<net::connection<message_t>> client)
+    {
+        return true;
+    }
+
+    virtual void onClientDisconnected(std::shared_ptr<net::connection<message_t>> client)
+    {
+        this->disconnections.fetch_add(1, std::memory_order_relaxed);
+        this->removeConnection(client);
+    }
+};
+
+// value of an optional "--name=value" argument, or fallback if not given
+std::string getOption(int argc, char *argv[], const std::string &name, const std::string &fallback)
+{
+    const std::string prefix = "--" + name + "=";
+    for (int i = 1; i < argc; ++i)
+        if (std::string(argv[i]).compare(0, prefix.size(), prefix) == 0)
+            return std::string(argv[i]).substr(prefix.size());
+    return fallback;
+}
+
+// waits up to a few seconds for done
+bool waitFor(const std::function<bool()> &done)
+{
+    const check_clock::time_point deadline = check_clock::now() + std::chrono::seconds(5);
+    while (!done())
+    {
+        if (check_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// dispatches until the server saw the one disconnection and freed its connection
+bool disconnectionHandled(check_server &server, const char *name)
+{
+    const bool handled = waitFor([&]() {
+        server.update();
+        return server.disconnections.load() == 1 && server.connectionCount() == 0;
+    });
+    if (!handled)
+    {
+        std::cerr << "FAIL " << name << ": disconnection lost, " << server.disconnections.load() << " dispatched, "
+                  << server.connectionCount() << " connection(s) left\n";
+        return false;
+    }
+    std::cout << "OK " << name << ": disconnection dispatched, no connection left\n";
+    return true;
+}
+
+bool checkFlood(uint16_t port, uint64_t commands)
+{
+    // no update until the client is gone, so everything it sends stays queued
+    check_server server(port);
+    server.start();
+
+    {
+        asio::io_context context;
+        asio::ip::tcp::socket socket(context);
+        socket.connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port));
+
+        std::vector<uint8_t> flood(commands * sizeof(message_t));
+        for (uint64_t i = 0; i < commands; ++i)
+            net::wire_codec<message_t>::encode(flood.data() + i * sizeof(message_t), 0.5f);
+        asio::write(socket, asio::buffer(flood));
+        if (!waitFor([&]() { return server.queued() + server.dropped() >= commands; }))
+        {
+            std::cerr << "FAIL flood: the server decoded " << server.queued() + server.dropped() << " of " << commands << " commands\n";
+            return false;
+        }
+        std::cout << "queued " << server.queued() << ", dropped " << server.dropped() << " of " << commands << " commands\n";
+    }
+
+    // the read error of the hang up queues the disconnection, behind the flood
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    const bool handled = disconnectionHandled(server, "flood");
+    server.stop();
+    return handled;
+}
+
+bool checkProtocolError(uint16_t port)
+{
+    check_server server(port);
+    server.start();
+
+    // the client keeps its socket open: only the server side closes it
+    asio::io_context context;
+    asio::ip::tcp::socket socket(context);
+    socket.connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port));
+
+    uint8_t frames[sizeof(net::protocol::magic) + 2 * net::protocol::headerSize + 4];
+    std::memcpy(frames, net::protocol::magic, sizeof(net::protocol::magic));
+    net::message_header<message_t> header;
+    header.id = net::msgType::Hello;
+    header.size = 4;
+    header.encode(frames + sizeof(net::protocol::magic));
+    net::wire::putU32(frames + sizeof(net::protocol::magic) + net::protocol::headerSize, net::protocol::version);
+    header.id = net::msgType::Telemetry;
+    header.size = uint16_t(net::protocol::maxPayloadSize + 1);
+    header.encode(frames + sizeof(net::protocol::magic) + net::protocol::headerSize + 4);
+    asio::write(socket, asio::buffer(frames));
+
+    const bool handled = disconnectionHandled(server, "protocol");
+    server.stop();
+    return handled;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint16_t port = uint16_t(std::stoul(getOption(argc, argv, "port", "60298")));
+    const uint64_t commands = std::stoull(getOption(argc, argv, "commands", "8192"));
+
+    const bool flood = checkFlood(port, commands);
+    const bool protocol = checkProtocolError(uint16_t(port + 1));
+    return flood && protocol ? 0 : 1;
+}
@@ -0,0 +1,389 @@
+// Load generator for the BreakOut server, standing in for the LabVIEW client
+// and the robot. Each simulated robot is a client_interface streaming a command
+// waveform at a fixed rate and timing the telemetry that reflects it (echo
+// latency: from the first send of a value to the feedback whose paddle position
+// matches it, so it includes the wait for the next session tick). A list of
+// rates is swept and each one reported as a row of the throughput/latency curve.
+//
+// g++ -std=c++17 -O2 tools/loadgen.cpp -o loadgen -pthread -lrt
+// MinGW: the "g++ build loadgen" task of .vscode/tasks.json (-lws2_32 -lwsock32 -lbcrypt)
+
+#include <fstream>
+#include <sstream>
+
+#include "../net/net.h"
+
+typedef float message_t;
+
+enum class transport
+{
+    framed, // commands in Command frames
+    legacy, // naked big-endian floats, like the LabVIEW client
+    udp,    // commands as datagrams, feedback over TCP
+    shm,    // commands through shared memory, feedback over TCP (same host, Linux)
+};
+
+// paddle command over time, in [0, 1]
+class waveform
+{
+public:
+    enum class shape
+    {
+        sine,
+        step,
+        trace,
+    };
+
+    waveform(shape form, float frequency, std::vector<float> trace = {})
+        : form(form), frequency(frequency), samples(std::move(trace))
+    {
+    }
+
+    // value of the index-th sample, sent at time t (s)
+    float at(double t, size_t index) const
+    {
+        switch (this->form)
+        {
+        case shape::sine:
+            return float(0.5 + 0.45 * std::sin(2.0 * 3.14159265358979323846 * this->frequency * t));
+        case shape::step:
+            return std::fmod(t * this->frequency, 1.0) < 0.5 ? 0.25f : 0.75f;
+        case shape::trace:
+            break;
+        }
+        return this->samples.empty() ? 0.5f : this->samples[index % this->samples.size()];
+    }
+
+private:
+    shape form;
+    float frequency;
+    std::vector<float> samples; // recorded trace, one sample per command, looped
+};
+
+// results of one rate, shared by the robots
+struct step_stats
+{
+    std::atomic<uint64_t> sent{0};
+    std::atomic<uint64_t> dropped{0};  // sends refused by the transport
+    std::atomic<uint64_t> missed{0};   // periods skipped because the sender fell behind
+    std::atomic<uint64_t> feedback{0}; // telemetry frames received
+    net::latency_histogram echo;
+};
+
+class robot
+{
+public:
+    robot() : udp(udpContext)
+    {
+    }
+
+public:
+    // waits until the connection (and its id, for the side channels) is up
+    bool connect(const std::string &host, uint16_t port, transport mode)
+    {
+        this->mode = mode;
+        const net::protocol_version protocol = mode == transport::legacy ? net::protocol_version::legacy : net::protocol_version::framed;
+        if (!this->client.connect(host, port, protocol))
+            return false;
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        const bool needsId = mode == transport::udp || mode == transport::shm;
+        while (!this->client.isConnected() || (needsId && this->client.getId() == 0))
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+                return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        if (mode == transport::udp)
+        {
+            asio::ip::udp::resolver resolver(this->udpContext);
+            this->udp.open(*resolver.resolve(asio::ip::udp::v4(), host, std::to_string(port)).begin(), this->client.getId());
+        }
+        if (mode == transport::shm)
+        {
+#if defined(__linux__)
+            if (!this->shm.create(this->client.getId()))
+                return false;
+            this->client.send(this->shm.attachMessage());
+#else
+            std::cerr << "[LOADGEN] Shared memory is only available on Linux.\n";
+            return false;
+#endif
+        }
+        return true;
+    }
+
+    // sends commands at rate (Hz) until the deadline, on the calling thread
+    void run(const waveform &wave, double rate, std::chrono::steady_clock::time_point until, step_stats &stats)
+    {
+        typedef std::chrono::steady_clock clock;
+        const auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / rate));
+        const clock::time_point start = clock::now();
+        clock::time_point next = start;
+        this->pending.clear();
+
+        for (size_t i = 0; next < until && this->client.isConnected(); ++i)
+        {
+            const float value = wave.at(std::chrono::duration<double>(next - start).count(), i);
+            const uint64_t now = net::protocol::timestampNow();
+            if (this->send(value))
+            {
+                stats.sent.fetch_add(1, std::memory_order_relaxed);
+                if (this->pending.empty() || this->pending.back().value != value)
+                    this->pending.push_back({value, now});
+            }
+            else
+            {
+                stats.dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+            while (!this->pending.empty() && now - this->pending.front().sent > 1000000000ull)
+                this->pending.pop_front();
+
+            this->drainFeedback(stats);
+
+            next += period;
+            const clock::time_point current = clock::now();
+            if (next + period < current)
+            {
+                // fell more than a period behind: skip rather than burst to catch up
+                stats.missed.fetch_add(uint64_t((current - next) / period), std::memory_order_relaxed);
+                next = current;
+            }
+            std::this_thread::sleep_until(next);
+        }
+        this->drainFeedback(stats);
+    }
+
+private:
+    struct sample
+    {
+        float value;
+        uint64_t sent; // ns, first send of this value
+    };
+
+    // feedback reflects a command within float rounding of the paddle position
+    static constexpr float echoTolerance = 1e-5f;
+
+    net::client_interface<message_t> client;
+    transport mode = transport::framed;
+    asio::io_context udpContext;
+    net::udp_sender<message_t> udp;
+#if defined(__linux__)
+    net::shm_sender<message_t> shm;
+#endif
+    std::deque<sample> pending; // distinct values sent lately, oldest first
+    uint64_t legacyFields = 0;  // legacy feedback arrives as naked floats, 4 per frame
+
+    bool send(float value)
+    {
+        switch (this->mode)
+        {
+        case transport::udp:
+            return this->udp.send(value);
+        case transport::shm:
+#if defined(__linux__)
+            return this->shm.send(value);
+#else
+            return false;
+#endif
+        default:
+        {
+            net::message<message_t> msg;
+            msg.header.id = net::msgType::Command;
+            msg.header.channel = net::msgChannel::command;
+            msg.encode(value);
+            this->client.send(msg);
+            return true;
+        }
+        }
+    }
+
+    void drainFeedback(step_stats &stats)
+    {
+        net::message_queue<message_t> &incoming = this->client.getIncomingMessages();
+        while (!incoming.empty())
+        {
+            const net::owned_message<message_t> msg = incoming.pop_front();
+            float actual;
+            if (this->mode == transport::legacy)
+            {
+                // the connection decodes the legacy stream as Command values, paddleActual comes first
+                if (msg.header.id != net::msgType::Command || this->legacyFields++ % 4 != 0)
+                    continue;
+                actual = msg.msg;
+            }
+            else
+            {
+                if (msg.header.id != net::msgType::Telemetry || !msg.reader().decode(actual))
+                    continue;
+            }
+            stats.feedback.fetch_add(1, std::memory_order_relaxed);
+            this->matchEcho(actual, msg.received, stats);
+        }
+    }
+
+    // the newest pending value the paddle sits at; older ones can no longer show up
+    void matchEcho(float actual, uint64_t received, step_stats &stats)
+    {
+        for (size_t i = this->pending.size(); i-- > 0;)
+        {
+            if (std::abs(this->pending[i].value - actual) <= echoTolerance)
+            {
+                if (received > this->pending[i].sent)
+                    stats.echo.record(received - this->pending[i].sent);
+                this->pending.erase(this->pending.begin(), this->pending.begin() + i + 1);
+                return;
+            }
+        }
+    }
+};
+
+// value of an optional "--name=value" argument, or fallback if not given
+std::string getOption(int argc, char *argv[], const std::string &name, const std::string &fallback)
+{
+    const std::string prefix = "--" + name + "=";
+    for (int i = 3; i < argc; ++i)
+        if (std::string(argv[i]).compare(0, prefix.size(), prefix) == 0)
+            return std::string(argv[i]).substr(prefix.size());
+    return fallback;
+}
+
+// whether an optional "--name" flag is given
+bool hasFlag(int argc, char *argv[], const std::string &name)
+{
+    for (int i = 3; i < argc; ++i)
+        if (argv[i] == "--" + name)
+            return true;
+    return false;
+}
+
+std::vector<double> parseRates(const std::string &list)
+{
+    std::vector<double> rates;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        rates.push_back(std::stod(item));
+    return rates;
+}
+
+// one value per line
+std::vector<float> loadTrace(const std::string &path)
+{
+    std::vector<float> samples;
+    std::ifstream file(path);
+    float value;
+    while (file >> value)
+        samples.push_back(std::max(0.0f, std::min(1.0f, value)));
+    return samples;
+}
+
+void printRow(std::ostream &os, bool csv, double rate, size_t connections, double seconds, const step_stats &stats)
+{
+    const net::latency_histogram &echo = stats.echo;
+    char line[192];
+    std::snprintf(line, sizeof(line),
+                  csv ? "%.0f,%zu,%.1f,%.1f,%llu,%llu,%llu,%.1f,%.1f,%.1f,%.1f\n"
+                      : "[LOADGEN] %8.0f %5zu %10.1f %10.1f %8llu %8llu %8llu %9.1f %9.1f %9.1f %9.1f\n",
+                  rate, connections, stats.sent / seconds, stats.feedback / seconds,
+                  (unsigned long long)stats.dropped.load(), (unsigned long long)stats.missed.load(), (unsigned long long)echo.count(),
+                  echo.percentile(50) / 1e3, echo.percentile(99) / 1e3, echo.percentile(99.9) / 1e3, echo.max() / 1e3);
+    os << line;
+}
+
+void printHeader(std::ostream &os, bool csv)
+{
+    if (csv)
+    {
+        os << "rate_hz,connections,sent_per_s,feedback_per_s,dropped,missed,echoes,echo_p50_us,echo_p99_us,echo_p999_us,echo_max_us\n";
+        return;
+    }
+    char line[192];
+    std::snprintf(line, sizeof(line), "[LOADGEN] %8s %5s %10s %10s %8s %8s %8s %9s %9s %9s %9s\n",
+                  "rate(Hz)", "conns", "sent/s", "fb/s", "dropped", "missed", "echoes", "p50(us)", "p99(us)", "p99.9(us)", "max(us)");
+    os << line;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cout << "Invalid number of arguments. Arguments must be:\n"
+                  << "- server host\n"
+                  << "- server port\n"
+                  << "optionally followed by:\n"
+                  << "- --connections=N: simulated robots (default: 1)\n"
+                  << "- --rates=HZ,HZ,...: command rates to sweep, per robot (default: 40,100,500,1000,5000,10000)\n"
+                  << "- --duration=SECONDS: time spent at each rate (default: 5)\n"
+                  << "- --wave=sine|step|trace: command waveform (default: sine)\n"
+                  << "- --frequency=HZ: frequency of the sine or step (default: 0.5)\n"
+                  << "- --trace=FILE: recorded commands for --wave=trace, one value in [0, 1] per line\n"
+                  << "- --transport=framed|legacy|udp|shm: how commands are sent (default: framed)\n"
+                  << "- --csv: print the curve as comma separated values\n";
+        return -1;
+    }
+
+    const std::string host = argv[1];
+    const uint16_t port = uint16_t(atoi(argv[2]));
+    const size_t connections = std::stoul(getOption(argc, argv, "connections", "1"));
+    const std::vector<double> rates = parseRates(getOption(argc, argv, "rates", "40,100,500,1000,5000,10000"));
+    const double duration = std::stod(getOption(argc, argv, "duration", "5"));
+    const float frequency = std::stof(getOption(argc, argv, "frequency", "0.5"));
+    const bool csv = hasFlag(argc, argv, "csv");
+
+    const std::string waveName = getOption(argc, argv, "wave", "sine");
+    waveform::shape form = waveform::shape::sine;
+    std::vector<float> trace;
+    if (waveName == "step")
+        form = waveform::shape::step;
+    else if (waveName == "trace")
+    {
+        form = waveform::shape::trace;
+        trace = loadTrace(getOption(argc, argv, "trace", ""));
+        if (trace.empty())
+        {
+            std::cerr << "[LOADGEN] --wave=trace needs a non empty --trace file.\n";
+            return -1;
+        }
+    }
+    const waveform wave(form, frequency, std::move(trace));
+
+    const std::string transportName = getOption(argc, argv, "transport", "framed");
+    transport mode = transport::framed;
+    if (transportName == "legacy")
+        mode = transport::legacy;
+    else if (transportName == "udp")
+        mode = transport::udp;
+    else if (transportName == "shm")
+        mode = transport::shm;
+
+    std::vector<std::unique_ptr<robot>> robots;
+    for (size_t i = 0; i < connections; ++i)
+    {
+        robots.push_back(std::make_unique<robot>());
+        if (!robots.back()->connect(host, port, mode))
+        {
+            std::cerr << "[LOADGEN] Connection " << i << " to " << host << ":" << port << " failed.\n";
+            return -1;
+        }
+    }
+
+    printHeader(std::cout, csv);
+    for (double rate : rates)
+    {
+        step_stats stats;
+        const auto start = std::chrono::steady_clock::now();
+        const auto until = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(duration));
+        std::vector<std::thread> threads;
+        for (auto &bot : robots)
+            threads.emplace_back(&robot::run, bot.get(), std::cref(wave), rate, until, std::ref(stats));
+        for (std::thread &thread : threads)
+            thread.join();
+
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printRow(std::cout, csv, rate, connections, seconds, stats);
+        std::cout.flush();
+    }
+    return 0;
+}
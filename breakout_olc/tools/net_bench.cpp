@@ -0,0 +1,397 @@
+// Microbenchmarks of the net/ layer on the command path: the inbound queues
+// (1P1C and NP1C), building and parsing msgs of 1 to 64 fields, decoding a
+// stream of frames through a server connection, and a loopback ping-pong
+// through server_interface. Every result is one JSON object per line, so that
+// runs can be diffed or fed to a regression check.
+//
+// g++ -std=c++17 -O2 tools/net_bench.cpp -o net_bench -pthread -lrt
+// MinGW: the "g++ build net_bench" task of .vscode/tasks.json (-lws2_32 -lwsock32 -lbcrypt)
+// ./net_bench [--filter=SUBSTRING] [--scale=FACTOR] [--out=FILE]
+
+#include <fstream>
+
+#include "../net/net.h"
+
+typedef float message_t;
+typedef std::chrono::steady_clock bench_clock;
+
+// results sink, one JSON object per line
+class reporter
+{
+public:
+    explicit reporter(std::ostream &os) : os(os)
+    {
+    }
+
+    // ops operations took seconds; param is the variable of the bench (fields, producers, ...)
+    void report(const std::string &name, const char *paramName, uint64_t param, uint64_t ops, double seconds, uint64_t dropped = 0)
+    {
+        char line[256];
+        std::snprintf(line, sizeof(line), "{\"bench\":\"%s\",\"%s\":%llu,\"ops\":%llu,\"dropped\":%llu,\"seconds\":%.6f,\"ops_per_s\":%.1f,\"ns_per_op\":%.2f}\n",
+                      name.c_str(), paramName, (unsigned long long)param, (unsigned long long)ops, (unsigned long long)dropped, seconds,
+                      ops / seconds, seconds * 1e9 / std::max<uint64_t>(ops, 1));
+        this->os << line;
+        this->os.flush();
+    }
+
+    void report(const std::string &name, const char *paramName, uint64_t param, const net::latency_histogram &histogram)
+    {
+        char line[256];
+        std::snprintf(line, sizeof(line), "{\"bench\":\"%s\",\"%s\":%llu,\"ops\":%llu,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+                      name.c_str(), paramName, (unsigned long long)param, (unsigned long long)histogram.count(),
+                      (unsigned long long)histogram.percentile(50), (unsigned long long)histogram.percentile(99),
+                      (unsigned long long)histogram.percentile(99.9), (unsigned long long)histogram.max());
+        this->os << line;
+        this->os.flush();
+    }
+
+private:
+    std::ostream &os;
+};
+
+double secondsSince(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+// keeps the optimizer from dropping a computed value
+template <typename TData>
+void keep(const TData &value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// concurrent_queue never refuses an item, the rings do when full
+template <typename TQueue, typename TItem>
+bool tryPush(TQueue &queue, const TItem &item)
+{
+    if constexpr (std::is_same<decltype(queue.push_back(item)), bool>::value)
+        return queue.push_back(item);
+    else
+        return queue.push_back(item), true;
+}
+
+// the rings are bounded and count what they refused, the locked queue never refuses
+template <typename TQueue>
+uint64_t droppedBy(TQueue &queue)
+{
+    if constexpr (std::is_same<TQueue, net::concurrent_queue<net::owned_message<message_t>>>::value)
+        return 0;
+    else
+        return queue.dropped();
+}
+
+// producers push count owned msgs in total, one consumer pops them all
+template <typename TQueue>
+void benchQueue(reporter &out, const std::string &name, size_t producers, uint64_t count)
+{
+    std::unique_ptr<TQueue> queue(new TQueue());
+    std::atomic<bool> go{false};
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p)
+    {
+        threads.emplace_back([&, p]() {
+            net::owned_message<message_t> msg;
+            msg.remoteId = uint32_t(p);
+            while (!go.load(std::memory_order_acquire))
+                ;
+            for (uint64_t i = p; i < count; i += producers)
+            {
+                msg.msg = message_t(i);
+                while (!tryPush(*queue, msg))
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    const bench_clock::time_point start = bench_clock::now();
+    go.store(true, std::memory_order_release);
+    for (uint64_t popped = 0; popped < count;)
+    {
+        if (queue->empty())
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        keep(queue->pop_front());
+        popped++;
+    }
+    const double seconds = secondsSince(start);
+    for (std::thread &thread : threads)
+        thread.join();
+    out.report(name, "producers", producers, count, seconds);
+}
+
+void benchQueues(reporter &out, uint64_t count)
+{
+    typedef net::owned_message<message_t> item;
+    benchQueue<net::spsc_queue<item>>(out, "queue.spsc", 1, count);
+    for (size_t producers : {1, 2, 4})
+    {
+        benchQueue<net::mpsc_queue<item>>(out, "queue.mpsc", producers, count);
+        benchQueue<net::concurrent_queue<item>>(out, "queue.locked", producers, count);
+    }
+}
+
+// build and parse cost of msgs of fields floats, raw (host order) and through wire_codec
+void benchMessages(reporter &out, uint64_t count)
+{
+    for (size_t fields : {1, 2, 4, 8, 16, 32, 64})
+    {
+        const uint64_t rounds = std::max<uint64_t>(1, count / fields);
+
+        bench_clock::time_point start = bench_clock::now();
+        for (uint64_t r = 0; r < rounds; ++r)
+        {
+            net::message<message_t> msg;
+            msg.header.id = net::msgType::Telemetry;
+            for (size_t f = 0; f < fields; ++f)
+                msg << float(f);
+            keep(msg);
+        }
+        out.report("message.build", "fields", fields, rounds, secondsSince(start));
+
+        start = bench_clock::now();
+        for (uint64_t r = 0; r < rounds; ++r)
+        {
+            net::message<message_t> msg;
+            msg.header.id = net::msgType::Telemetry;
+            for (size_t f = 0; f < fields; ++f)
+                msg.encode(float(f));
+            keep(msg);
+        }
+        out.report("message.build_wire", "fields", fields, rounds, secondsSince(start));
+
+        net::message<message_t> built;
+        for (size_t f = 0; f < fields; ++f)
+            built.encode(float(f));
+
+        start = bench_clock::now();
+        for (uint64_t r = 0; r < rounds; ++r)
+        {
+            net::message_reader reader = built.reader();
+            float value = 0, sum = 0;
+            while (reader.read(value))
+                sum += value;
+            keep(sum);
+        }
+        out.report("message.parse", "fields", fields, rounds, secondsSince(start));
+
+        start = bench_clock::now();
+        for (uint64_t r = 0; r < rounds; ++r)
+        {
+            net::message_reader reader = built.reader();
+            float value = 0, sum = 0;
+            while (reader.decode(value))
+                sum += value;
+            keep(sum);
+        }
+        out.report("message.parse_wire", "fields", fields, rounds, secondsSince(start));
+    }
+}
+
+// counts commands, echoes them back if asked; update runs on a thread of its own
+class bench_server : public net::server_interface<message_t>
+{
+public:
+    bench_server(uint16_t port, bool echo) : net::server_interface<message_t>(port), echo(echo)
+    {
+    }
+
+    std::atomic<uint64_t> commands{0};
+
+    // commands the asio thread could not queue
+    uint64_t dropped() { return droppedBy(this->msgsIn); }
+
+protected:
+    virtual bool onClientConnecting(std::shared_ptr<net::connection<message_t>> client)
+    {
+        return true;
+    }
+
+    virtual void onClientDisconnected(std::shared_ptr<net::connection<message_t>> client)
+    {
+        this->removeConnection(client);
+    }
+
+    virtual void onMessage(std::shared_ptr<net::connection<message_t>> client, message_t msg)
+    {
+        this->commands.fetch_add(1, std::memory_order_relaxed);
+        if (!this->echo)
+            return;
+        net::message<message_t> reply;
+        reply.header.id = net::msgType::Command;
+        reply.header.channel = net::msgChannel::command;
+        reply.encode(msg);
+        client->send(reply);
+    }
+
+private:
+    bool echo;
+};
+
+// runs update until stopped; stopping needs one more msg to wake it
+class server_runner
+{
+public:
+    server_runner(bench_server &server) : server(server)
+    {
+        server.start();
+        this->thread = std::thread([this]() {
+            while (this->running)
+                this->server.update(-1, true);
+        });
+    }
+
+    void stop(const std::function<void()> &wake)
+    {
+        this->running = false;
+        wake();
+        this->thread.join();
+        this->server.stop();
+    }
+
+private:
+    bench_server &server;
+    std::atomic<bool> running{true};
+    std::thread thread;
+};
+
+// frames written in large chunks by a raw socket, timed until the server dispatched (or dropped) them all
+void benchConnectionStream(reporter &out, uint16_t port, bool framed, uint64_t count)
+{
+    bench_server server(port, false);
+    server_runner runner(server);
+
+    asio::io_context context;
+    asio::ip::tcp::socket socket(context);
+    socket.connect(asio::ip::tcp::endpoint(asio::ip::address_v4::loopback(), port));
+
+    const size_t frameSize = framed ? net::protocol::headerSize + sizeof(message_t) : sizeof(message_t);
+    std::vector<uint8_t> chunk(frameSize * 256);
+    if (framed)
+    {
+        uint8_t hello[sizeof(net::protocol::magic) + net::protocol::headerSize + 4];
+        std::memcpy(hello, net::protocol::magic, sizeof(net::protocol::magic));
+        net::message_header<message_t> header;
+        header.id = net::msgType::Hello;
+        header.size = 4;
+        header.encode(hello + sizeof(net::protocol::magic));
+        net::wire::putU32(hello + sizeof(net::protocol::magic) + net::protocol::headerSize, net::protocol::version);
+        asio::write(socket, asio::buffer(hello));
+    }
+    for (size_t i = 0; i < 256; ++i)
+    {
+        uint8_t *frame = chunk.data() + i * frameSize;
+        if (framed)
+        {
+            net::message_header<message_t> header;
+            header.id = net::msgType::Command;
+            header.channel = net::msgChannel::command;
+            header.size = sizeof(message_t);
+            header.sequence = uint32_t(i + 1);
+            header.encode(frame);
+            frame += net::protocol::headerSize;
+        }
+        net::wire_codec<message_t>::encode(frame, 0.5f);
+    }
+
+    // the server only counts commands once the connection is up
+    const bench_clock::time_point start = bench_clock::now();
+    const uint64_t chunks = std::max<uint64_t>(1, count / 256);
+    for (uint64_t c = 0; c < chunks; ++c)
+        asio::write(socket, asio::buffer(chunk));
+    while (server.commands.load(std::memory_order_relaxed) + server.dropped() < chunks * 256 && secondsSince(start) < 30)
+        std::this_thread::yield();
+    const double seconds = secondsSince(start);
+    // decoded frames, whether the bounded inbound queue could take them or not
+    out.report(framed ? "connection.stream_framed" : "connection.stream_legacy", "frame_bytes", frameSize,
+               server.commands.load() + server.dropped(), seconds, server.dropped());
+
+    runner.stop([&]() { asio::write(socket, asio::buffer(chunk.data(), frameSize)); });
+}
+
+// round trips of one command at a time through client_interface and server_interface
+void benchPingPong(reporter &out, uint16_t port, uint64_t count)
+{
+    bench_server server(port, true);
+    server_runner runner(server);
+
+    net::client_interface<message_t> client;
+    client.connect("127.0.0.1", port);
+    while (!client.isConnected() || client.getId() == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    net::latency_histogram rtt;
+    net::message_queue<message_t> &incoming = client.getIncomingMessages();
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        net::message<message_t> ping;
+        ping.header.id = net::msgType::Command;
+        ping.header.channel = net::msgChannel::command;
+        ping.encode(message_t(i % 1000) / 1000.0f);
+
+        const uint64_t sent = net::protocol::timestampNow();
+        client.send(ping);
+        const bench_clock::time_point deadline = bench_clock::now() + std::chrono::seconds(1);
+        bool answered = false;
+        while (!answered && bench_clock::now() < deadline)
+        {
+            if (incoming.empty())
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            const net::owned_message<message_t> pong = incoming.pop_front();
+            answered = pong.header.id == net::msgType::Command;
+            if (answered)
+                rtt.record(pong.received - sent);
+        }
+        if (!answered)
+            break;
+    }
+    out.report("server.ping_pong", "payload_bytes", sizeof(message_t), rtt);
+
+    runner.stop([&]() { client.send(net::message<message_t>()); });
+    client.disconnect();
+}
+
+// value of an optional "--name=value" argument, or fallback if not given
+std::string getOption(int argc, char *argv[], const std::string &name, const std::string &fallback)
+{
+    const std::string prefix = "--" + name + "=";
+    for (int i = 1; i < argc; ++i)
+        if (std::string(argv[i]).compare(0, prefix.size(), prefix) == 0)
+            return std::string(argv[i]).substr(prefix.size());
+    return fallback;
+}
+
+int main(int argc, char *argv[])
+{
+    const std::string filter = getOption(argc, argv, "filter", "");
+    const double scale = std::stod(getOption(argc, argv, "scale", "1"));
+    const uint16_t port = uint16_t(std::stoul(getOption(argc, argv, "port", "60299")));
+    const std::string path = getOption(argc, argv, "out", "");
+
+    // server logs go to stdout, so results can be written to a file of their own
+    std::ofstream file;
+    if (!path.empty())
+        file.open(path);
+    reporter out(path.empty() ? std::cout : file);
+
+    const auto selected = [&](const char *group) { return filter.empty() || std::string(group).find(filter) != std::string::npos; };
+    const auto scaled = [&](uint64_t count) { return std::max<uint64_t>(1, uint64_t(count * scale)); };
+
+    if (selected("queue"))
+        benchQueues(out, scaled(1000000));
+    if (selected("message"))
+        benchMessages(out, scaled(2000000));
+    if (selected("connection"))
+    {
+        benchConnectionStream(out, port, false, scaled(1000000));
+        benchConnectionStream(out, port + 1, true, scaled(1000000));
+    }
+    if (selected("server"))
+        benchPingPong(out, port + 2, scaled(20000));
+    return 0;
+}
@@ -0,0 +1,145 @@
+// Checks that a client_interface can disconnect and connect again, many times
+// over: each connection must be approved with an id of its own, and each
+// reconnect must ask for the earlier session back with the token the server
+// gave the previous connection. Build it with -fsanitize=address as well, to
+// catch handlers of an old connection running after it was freed. Exits with
+// 1 on the first failure, so it can gate a build.
+//
+// g++ -std=c++17 -O2 tools/reconnect_check.cpp -o reconnect_check -pthread -lrt
+// MinGW: the "g++ build reconnect_check" task of .vscode/tasks.json (-lws2_32 -lwsock32 -lbcrypt)
+// ./reconnect_check [--port=PORT] [--rounds=N]
+
+#include "../net/net.h"
+
+typedef float message_t;
+typedef std::chrono::steady_clock check_clock;
+
+// remembers the token of each connection and the one each resume request carried
+class check_server : public net::server_interface<message_t>
+{
+public:
+    explicit check_server(uint16_t port) : net::server_interface<message_t>(port)
+    {
+    }
+
+    std::mutex mtx;
+    std::unordered_map<uint32_t, uint64_t> tokens;  // by connection id
+    std::unordered_map<uint32_t, uint64_t> resumed; // by connection id, the token it sent
+
+protected:
+    virtual bool onClientConnecting(std::shared_ptr<net::connection<message_t>> client)
+    {
+        return true;
+    }
+
+    virtual void onClientConnected(std::shared_ptr<net::connection<message_t>> client)
+    {
+        const std::lock_guard<std::mutex> lock(this->mtx);
+        this->tokens[client->getId()] = client->getToken();
+    }
+
+    virtual void onClientDisconnected(std::shared_ptr<net::connection<message_t>> client)
+    {
+        this->removeConnection(client);
+    }
+
+    virtual void onFrame(std::shared_ptr<net::connection<message_t>> client, const net::owned_message<message_t> &msg)
+    {
+        if (msg.header.id != net::msgType::Hello || msg.body.size() < 12)
+            return;
+        const std::lock_guard<std::mutex> lock(this->mtx);
+        this->resumed[client->getId()] = net::wire::getU64(msg.body.data() + 4);
+    }
+};
+
+// value of an optional "--name=value" argument, or fallback if not given
+std::string getOption(int argc, char *argv[], const std::string &name, const std::string &fallback)
+{
+    const std::string prefix = "--" + name + "=";
+    for (int i = 1; i < argc; ++i)
+        if (std::string(argv[i]).compare(0, prefix.size(), prefix) == 0)
+            return std::string(argv[i]).substr(prefix.size());
+    return fallback;
+}
+
+// waits up to a few seconds for done
+bool waitFor(const std::function<bool()> &done)
+{
+    const check_clock::time_point deadline = check_clock::now() + std::chrono::seconds(5);
+    while (!done())
+    {
+        if (check_clock::now() > deadline)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint16_t port = uint16_t(std::stoul(getOption(argc, argv, "port", "60296")));
+    const int rounds = std::stoi(getOption(argc, argv, "rounds", "50"));
+
+    check_server server(port);
+    server.start();
+    std::atomic<bool> running{true};
+    std::thread updater([&]() {
+        while (running)
+        {
+            server.update();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    net::client_interface<message_t> client;
+    uint32_t previousId = 0;
+    bool ok = true;
+    for (int round = 0; ok && round < rounds; ++round)
+    {
+        client.connect("127.0.0.1", port);
+        if (!waitFor([&]() { return client.isConnected() && client.getId() != 0; }))
+        {
+            std::cerr << "FAIL: round " << round << " was not approved\n";
+            ok = false;
+            break;
+        }
+
+        // some traffic, so that reads and writes are pending when it disconnects
+        net::message<message_t> command;
+        command.header.id = net::msgType::Command;
+        command.header.channel = net::msgChannel::command;
+        command.encode(0.5f);
+        for (int i = 0; i < 20; ++i)
+            client.send(command);
+
+        const uint32_t id = client.getId();
+        if (id == previousId)
+        {
+            std::cerr << "FAIL: round " << round << " got the id of the previous connection\n";
+            ok = false;
+        }
+        else if (previousId != 0)
+        {
+            const bool asked = waitFor([&]() {
+                const std::lock_guard<std::mutex> lock(server.mtx);
+                return server.resumed.count(id) != 0;
+            });
+            const std::lock_guard<std::mutex> lock(server.mtx);
+            if (!asked || server.resumed[id] != server.tokens[previousId])
+            {
+                std::cerr << "FAIL: round " << round << " did not resume with the token of connection " << previousId << "\n";
+                ok = false;
+            }
+        }
+        previousId = id;
+        client.disconnect();
+    }
+
+    running = false;
+    updater.join();
+    server.stop();
+
+    if (ok)
+        std::cout << "OK: " << rounds << " reconnects, each resuming with the previous token\n";
+    return ok ? 0 : 1;
+}